@@ -0,0 +1,279 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "inbox.h"
+#include "stats.h"
+
+/* Inbox transport
+ *
+ * Every process owns one pipe, its inbox.
+ * All peers keep the write end of it and the owner keeps the read end,
+ * so there are N pipes instead of N * (N - 1) and each process holds
+ * N descriptors after inbox_attach.
+ *
+ * Frames written to an inbox carry sender id in front of the message:
+ *
+ *    +--------+---------------+---------+
+ *    | s_from | MessageHeader | payload |
+ *    +--------+---------------+---------+
+ *
+ * Whole frame goes in one writev() of at most PIPE_BUF bytes, which
+ * pipe guarantees not to interleave with frames of other writers.
+ * Reader pulls everything available in one read() into inbox buffer
+ * and cuts frames from there.
+ */
+
+enum {
+    INBOX_BUF_SIZE = 1 << 16,
+    INBOX_PIPE_SIZE = 1 << 20 ///< shared by all writers, ask for more than default
+};
+
+typedef struct {
+    node_id s_from; ///< two bytes keep MessageHeader aligned at the head of inbox buffer
+} __attribute__((packed)) InboxHeader;
+
+static size_t frame_len(const char * frame)
+{
+    const MessageHeader * header = (const MessageHeader *)(frame + sizeof(InboxHeader));
+    return sizeof(InboxHeader) + sizeof(MessageHeader) + header->s_payload_len;
+}
+
+int inbox_init(TaskStruct * task)
+{
+    int n = task->total_proc;
+    task->inboxes = (int(*)[2])malloc(sizeof(int) * 2 * n);
+    for (node_id i = 0; i < n; i++) {
+        if (RC_FAIL(pipe2(task->inboxes[i], O_NONBLOCK))) {
+            return -1;
+        }
+        // best effort, default 64K may be tight for N writers
+        (void)fcntl(task->inboxes[i][0], F_SETPIPE_SZ, INBOX_PIPE_SIZE);
+    }
+
+    return 0;
+}
+
+int inbox_attach(TaskStruct * task)
+{
+    for (node_id i = 0; i < task->total_proc; i++) {
+        int unused = (i == task->local_pid) ? task->inboxes[i][1] : task->inboxes[i][0];
+        if (close(unused)) {
+            perror("inbox_attach close error");
+            return -1;
+        }
+    }
+
+    task->inbox_buf = malloc(INBOX_BUF_SIZE);
+    task->inbox_len = 0;
+    return 0;
+}
+
+int inbox_send(TaskStruct * task, node_id dst, const Message * msg)
+{
+    if (dst == task->local_pid || dst < 0 || dst >= task->total_proc) {
+        return -1;
+    }
+
+    InboxHeader header = {task->local_pid};
+    struct iovec iov[2] = {
+        {&header, sizeof(header)},
+        {(void *)msg, sizeof(MessageHeader) + msg->s_header.s_payload_len}};
+    if (iov[0].iov_len + iov[1].iov_len > PIPE_BUF) {
+        fprintf(stderr, "inbox_send: message of %zu bytes can't be written atomically\n", iov[1].iov_len);
+        return -1;
+    }
+
+    int fd = task->inboxes[dst][1];
+    stats_syscall();
+    while (writev(fd, iov, 2) < 0) {
+        stats_syscall();
+        if (errno == EAGAIN) {
+            // inbox is full, wait for the owner to drain it
+            stats_eagain();
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            (void)poll(&pfd, 1, -1);
+        }
+        else if (errno != EINTR) {
+            perror("inbox_send writev error");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @return 1 if something was read, 0 if inbox is empty, -1 on error
+ */
+static int inbox_fill(TaskStruct * task)
+{
+    if (task->inbox_len == INBOX_BUF_SIZE) {
+        // stuffed with frames nobody asked for yet
+        return 0;
+    }
+
+    int fd = task->inboxes[task->local_pid][0];
+    stats_syscall();
+    ssize_t len = read(fd, task->inbox_buf + task->inbox_len, INBOX_BUF_SIZE - task->inbox_len);
+    if (len > 0) {
+        task->inbox_len += len;
+        return 1;
+    }
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        if (errno == EAGAIN) {
+            stats_eagain();
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Take frame from inbox buffer at given offset
+ * and close the gap behind it
+ */
+static node_id inbox_take(TaskStruct * task, size_t off, Message * msg)
+{
+    char * frame = task->inbox_buf + off;
+    size_t len = frame_len(frame);
+    node_id from = ((const InboxHeader *)frame)->s_from;
+
+    memcpy(msg, frame + sizeof(InboxHeader), len - sizeof(InboxHeader));
+    memmove(frame, frame + len, task->inbox_len - off - len);
+    task->inbox_len -= len;
+    return from;
+}
+
+/**
+ * @return offset of the first complete frame from given sender
+ *         (or from anybody if from < 0) or -1
+ */
+static long inbox_find(TaskStruct * task, node_id from)
+{
+    size_t off = 0;
+    while (off + sizeof(InboxHeader) + sizeof(MessageHeader) <= task->inbox_len) {
+        const char * frame = task->inbox_buf + off;
+        size_t len = frame_len(frame);
+        if (off + len > task->inbox_len) {
+            break;
+        }
+        if (from < 0 || ((const InboxHeader *)frame)->s_from == from) {
+            return off;
+        }
+        off += len;
+    }
+    return -1;
+}
+
+int inbox_receive(TaskStruct * task, node_id from, Message * msg)
+{
+    if (from == task->local_pid || from < 0 || from >= task->total_proc) {
+        return -1;
+    }
+
+    long off = inbox_find(task, from);
+    if (off < 0 && inbox_fill(task) > 0) {
+        off = inbox_find(task, from);
+    }
+    if (off < 0) {
+        return -1;
+    }
+
+    (void)inbox_take(task, off, msg);
+    return 0;
+}
+
+/**
+ * Wait for a whole frame at the head of inbox buffer
+ *
+ * @param view    Message of the frame, left in the buffer
+ *
+ * @return sender of the frame or -1 on error
+ */
+node_id inbox_peek(TaskStruct * task, const Message ** view)
+{
+    while (1) {
+        if (inbox_find(task, -1) == 0) {
+            *view = (const Message *)(task->inbox_buf + sizeof(InboxHeader));
+            return ((const InboxHeader *)task->inbox_buf)->s_from;
+        }
+
+        int rc = inbox_fill(task);
+        if (rc < 0) {
+            perror("inbox_peek read error");
+            return -1;
+        }
+        if (rc == 0) {
+            stats_empty_poll();
+            stats_syscall();
+            struct pollfd pfd = {task->inboxes[task->local_pid][0], POLLIN, 0};
+            (void)poll(&pfd, 1, -1);
+        }
+    }
+}
+
+/**
+ * Drop frame at the head of inbox buffer
+ */
+void inbox_drop(TaskStruct * task)
+{
+    size_t len = frame_len(task->inbox_buf);
+    task->inbox_len -= len;
+    memmove(task->inbox_buf, task->inbox_buf + len, task->inbox_len);
+}
+
+int inbox_receive_any(TaskStruct * task, Message * msg)
+{
+    const Message * view;
+    if (inbox_peek(task, &view) < 0) {
+        return -1;
+    }
+    return inbox_take(task, 0, msg);
+}
+
+int inbox_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max)
+{
+    while (1) {
+        // pick up whatever arrived since the last call
+        int rc = inbox_fill(task);
+
+        // cut frames in order and close the gap once for all of them
+        size_t n = 0;
+        size_t off = 0;
+        while (n < max && off + sizeof(InboxHeader) + sizeof(MessageHeader) <= task->inbox_len) {
+            const char * frame = task->inbox_buf + off;
+            size_t len = frame_len(frame);
+            if (off + len > task->inbox_len) {
+                break;
+            }
+            from[n] = ((const InboxHeader *)frame)->s_from;
+            memcpy(&out[n], frame + sizeof(InboxHeader), len - sizeof(InboxHeader));
+            off += len;
+            n++;
+        }
+        if (n > 0) {
+            memmove(task->inbox_buf, task->inbox_buf + off, task->inbox_len - off);
+            task->inbox_len -= off;
+            return n;
+        }
+        if (rc < 0) {
+            perror("inbox_receive_batch read error");
+            return -1;
+        }
+        stats_empty_poll();
+        stats_syscall();
+
+        struct pollfd pfd = {task->inboxes[task->local_pid][0], POLLIN, 0};
+        (void)poll(&pfd, 1, -1);
+    }
+}
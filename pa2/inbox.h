@@ -0,0 +1,22 @@
+#ifndef INBOX_H_
+#define INBOX_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+int inbox_init(TaskStruct * task);
+
+int inbox_attach(TaskStruct * task);
+
+int inbox_send(TaskStruct * task, node_id dst, const Message * msg);
+
+int inbox_receive(TaskStruct * task, node_id from, Message * msg);
+
+int inbox_receive_any(TaskStruct * task, Message * msg);
+
+node_id inbox_peek(TaskStruct * task, const Message ** view);
+
+void inbox_drop(TaskStruct * task);
+
+int inbox_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max);
+#endif
@@ -1,74 +1,708 @@
+#include <errno.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/epoll.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "binlog.h"
+#include "broker.h"
+#include "frame.h"
+#include "inbox.h"
+#include "latency.h"
 #include "ipc.h"
 #include "pipes.h"
 #include "proc.h"
+#include "ring.h"
+#include "seqpacket.h"
+#include "slab.h"
+#include "stats.h"
+#include "timeline.h"
+#include "tree.h"
+#include "uring.h"
 
 
-int send(void * self, local_id dst, const Message * msg)
+/* Write end of a channel with pending output sits in the
+ * readiness set too, flagged to tell it from incoming ends
+ */
+#define POLL_WRITABLE 0x10000
+
+/**
+ * Keep write end in the readiness set exactly while
+ * the channel has pending output
+ */
+static int pipe_watch_output(TaskStruct * task, node_id dst)
+{
+    Channel * ch = &task->channels[dst];
+    int want = ch->out_len > 0;
+    if (want == ch->out_polled) {
+        return 0;
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLOUT;
+    event.data.u32 = dst | POLL_WRITABLE;
+    if (epoll_ctl(task->epoll_fd, want ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, get_recipient(task, dst), &event) < 0) {
+        perror("pipe_watch_output epoll_ctl error");
+        return -1;
+    }
+    ch->out_polled = want;
+    return 0;
+}
+
+static int pipe_send(TaskStruct * task, node_id dst, const Message * msg)
 {
-    TaskStruct * task = self;
     int fd = get_recipient(task, dst);
-    if (fd < 0 || write(fd, msg, sizeof(MessageHeader) + (msg->s_header).s_payload_len) < 0) {
+    if (fd < 0 && task->lazy && dst != task->local_pid && RC_OK(broker_connect(task, dst))) {
+        fd = get_recipient(task, dst);
+    }
+    if (fd < 0 || frame_write(&task->channels[dst], fd, msg, sizeof(MessageHeader) + (msg->s_header).s_payload_len) < 0) {
         perror("send error");
         return -1;
     }
 
-    pipe_log(task, dst, msg, OUTCOMING);
+    // queued frames wait for send_commit, which also manages EPOLLOUT
+    return 0;
+}
+
+static int pipe_receive(TaskStruct * task, node_id from, Message * msg)
+{
+    int fd = get_sender(task, from);
+    if (fd < 0 && task->lazy && from != task->local_pid) {
+        // channel may be waiting in the control socket
+        (void)broker_poll(task);
+        fd = get_sender(task, from);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+
+    Channel * ch = &task->channels[from];
+    if (!frame_ready(ch) && frame_fill(ch, fd) <= 0) {
+        return -1;
+    }
+
+    return frame_next(ch, msg);
+}
+
+/**
+ * Wait until some channel has a whole frame at its head
+ *
+ * @return peer of that channel or -1 on error
+ */
+static node_id pipe_wait_frame(TaskStruct * task)
+{
+    while (1) {
+        // visit channels reported by the last epoll_wait first,
+        // one message per channel to keep senders served in turn
+        while (task->ready_pos < task->ready_len) {
+            const struct epoll_event * event = &task->ready[task->ready_pos++];
+            node_id peer = event->data.u32 & ~(POLL_WRITABLE | POLL_BROKER);
+            if (event->data.u32 & POLL_BROKER) {
+                if (RC_FAIL(broker_handle(task, peer))) {
+                    return -1;
+                }
+                continue;
+            }
+            if (event->data.u32 & POLL_WRITABLE) {
+                if (frame_flush(&task->channels[peer], get_recipient(task, peer)) < 0 ||
+                    RC_FAIL(pipe_watch_output(task, peer))) {
+                    return -1;
+                }
+                continue;
+            }
+            Channel * ch = &task->channels[peer];
+            if (frame_ready(ch) || (frame_fill(ch, get_sender(task, peer)) > 0 && frame_ready(ch))) {
+                return peer;
+            }
+            if (event->events & (EPOLLHUP | EPOLLERR)) {
+                // all writers are gone, nothing will come from here anymore
+                epoll_ctl(task->epoll_fd, EPOLL_CTL_DEL, get_sender(task, peer), NULL);
+            }
+        }
+
+        // whole frames left in channel buffers are invisible to epoll
+        for (node_id from = 0; from < task->total_proc; from++) {
+            if (from != task->local_pid && frame_ready(&task->channels[from])) {
+                return from;
+            }
+        }
+
+        stats_empty_poll();
+        stats_syscall();
+        int n = epoll_wait(task->epoll_fd, task->ready, 2 * task->total_proc, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("receive_any epoll_wait error");
+            return -1;
+        }
+        task->ready_len = n;
+        task->ready_pos = 0;
+    }
+}
+
+static int pipe_receive_any(TaskStruct * task, Message * msg)
+{
+    node_id from = pipe_wait_frame(task);
+    if (from < 0 || RC_FAIL(frame_next(&task->channels[from], msg))) {
+        return -1;
+    }
+    return from;
+}
+
+static int pipe_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max)
+{
+    size_t n = 0;
+    while (1) {
+        // whole frames left in channel buffers go first
+        for (node_id peer = 0; peer < task->total_proc && n < max; peer++) {
+            if (peer == task->local_pid) {
+                continue;
+            }
+            while (n < max && RC_OK(frame_next(&task->channels[peer], &out[n]))) {
+                from[n++] = peer;
+            }
+        }
+
+        // then a single read per ready channel, cutting every frame it brought
+        while (n < max && task->ready_pos < task->ready_len) {
+            const struct epoll_event * event = &task->ready[task->ready_pos++];
+            node_id peer = event->data.u32 & ~(POLL_WRITABLE | POLL_BROKER);
+            if (event->data.u32 & POLL_BROKER) {
+                if (RC_FAIL(broker_handle(task, peer))) {
+                    return -1;
+                }
+                continue;
+            }
+            if (event->data.u32 & POLL_WRITABLE) {
+                if (frame_flush(&task->channels[peer], get_recipient(task, peer)) < 0 ||
+                    RC_FAIL(pipe_watch_output(task, peer))) {
+                    return -1;
+                }
+                continue;
+            }
+
+            Channel * ch = &task->channels[peer];
+            if (frame_fill(ch, get_sender(task, peer)) < 0) {
+                // all writers are gone, nothing will come from here anymore
+                epoll_ctl(task->epoll_fd, EPOLL_CTL_DEL, get_sender(task, peer), NULL);
+            }
+            while (n < max && RC_OK(frame_next(ch, &out[n]))) {
+                from[n++] = peer;
+            }
+        }
+
+        if (n > 0) {
+            return n;
+        }
+
+        stats_empty_poll();
+        stats_syscall();
+        int ready = epoll_wait(task->epoll_fd, task->ready, 2 * task->total_proc, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("receive_batch epoll_wait error");
+            return -1;
+        }
+        task->ready_len = ready;
+        task->ready_pos = 0;
+    }
+}
+
+static int uring_receive(TaskStruct * task, node_id from, Message * msg)
+{
+    if (get_sender(task, from) < 0) {
+        return -1;
+    }
+
+    Channel * ch = &task->channels[from];
+    if (!frame_ready(ch) && RC_FAIL(uring_poll(task))) {
+        return -1;
+    }
+    return frame_next(ch, msg);
+}
+
+static int uring_receive_any(TaskStruct * task, Message * msg)
+{
+    node_id from = uring_wait_frame(task);
+    if (from < 0 || RC_FAIL(frame_next(&task->channels[from], msg))) {
+        return -1;
+    }
+    return from;
+}
+
+static int uring_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max)
+{
+    node_id first = uring_wait_frame(task);
+    if (first < 0) {
+        return -1;
+    }
+
+    // completions reaped by the wait may have filled several channels
+    size_t n = 0;
+    for (int i = 0; i < task->total_proc && n < max; i++) {
+        node_id peer = (first + i) % task->total_proc;
+        if (peer == task->local_pid) {
+            continue;
+        }
+        while (n < max && RC_OK(frame_next(&task->channels[peer], &out[n]))) {
+            from[n++] = peer;
+        }
+    }
+    return n;
+}
+
+/**
+ * Receive side of the step commit: io_uring only prepares writes,
+ * the wait for input submits them in the same syscall
+ */
+static int receive_commit(TaskStruct * task)
+{
+    if (task->transport == TRANSPORT_URING) {
+        uring_arm(task);
+        return 0;
+    }
+    return send_commit(task);
+}
+
+static int transport_send(TaskStruct * task, node_id dst, const Message * msg)
+{
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        return ring_send(task, dst, msg);
+    case TRANSPORT_INBOX:
+        return inbox_send(task, dst, msg);
+    case TRANSPORT_URING:
+        return uring_send(task, dst, msg);
+    case TRANSPORT_SEQPACKET:
+        return seqpacket_send(task, dst, msg);
+    default:
+        return pipe_send(task, dst, msg);
+    }
+}
+
+/**
+ * Log a message every way it may be asked for
+ *
+ * hop is the process the frame went to or came from, peer is the one
+ * the lab sees, they differ for frames forwarded along a tree
+ */
+static void log_message(TaskStruct * task, node_id hop, node_id peer, const Message * msg, int direction)
+{
+    if (task->timeline) {
+        (void)timeline_message(task, hop, peer, msg, direction);
+    }
+    if (stats_page != NULL) {
+        stats_message(hop, msg, direction == OUTCOMING);
+    }
+    pipe_log(task, peer, msg, direction);
+}
+
+int send_to(void * self, node_id dst, const Message * msg)
+{
+    TaskStruct * task = self;
+    Message stamped;
+    const Message * frame = (task->latency != NULL) ? latency_stamp(msg, &stamped) : msg;
+    if (RC_FAIL(transport_send(task, dst, frame))) {
+        return -1;
+    }
+
+    log_message(task, dst, dst, msg, OUTCOMING);
+    return 0;
+}
+
+int send(void * self, local_id dst, const Message * msg)
+{
+    return send_to(self, dst, msg);
+}
+
+static int tree_send(TaskStruct * task, node_id root, const Message * frame, const Message * msg)
+{
+    node_id children[TREE_MAX_CHILDREN];
+    int count = tree_children(task, root, children);
+    for (int i = 0; i < count; i++) {
+        if (RC_FAIL(transport_send(task, children[i], frame))) {
+            return -1;
+        }
+        log_message(task, children[i], children[i], msg, OUTCOMING);
+    }
+
     return 0;
 }
 
+/**
+ * Pass received tree frame down the tree and unwrap it
+ *
+ * @return id of the original sender
+ */
+static node_id tree_accept(TaskStruct * task, node_id from, Message * msg)
+{
+    if (msg->s_header.s_magic != TREE_MAGIC) {
+        return from;
+    }
+
+    Message frame;
+    memcpy(&frame, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len);
+    node_id root = tree_unwrap(msg);
+
+    // subtree waits on us, don't hold it until our next receive
+    if (RC_FAIL(tree_send(task, root, &frame, msg)) || RC_FAIL(send_commit(task))) {
+        perror("tree_accept forward error");
+    }
+    return root;
+}
+
 int send_multicast(void * self, const Message * msg)
 {
     TaskStruct * task = self;
+
+    // one stamp for every receiver, slab and tree carry it along
+    Message stamped;
+    const Message * frame = (task->latency != NULL) ? latency_stamp(msg, &stamped) : msg;
+
+    // store the message once, peers get a reference to it
+    Message ref;
+    frame = RC_OK(slab_publish(task, frame, &ref)) ? &ref : frame;
+
+    Message wrapped;
+    if (task->multicast == MULTICAST_TREE && RC_OK(tree_wrap(task, frame, &wrapped))) {
+        return tree_send(task, task->local_pid, &wrapped, msg);
+    }
+
     for (int dst = 0; dst < task->total_proc; dst++) {
         if (dst == task->local_pid) {
             continue;
         }
-        if (RC_FAIL(send(self, dst, msg))) {
+        if (RC_FAIL(transport_send(task, dst, frame))) {
             return -1;
         }
+        log_message(task, dst, dst, msg, OUTCOMING);
     }
 
     return 0;
 }
 
+int receive_from(void * self, node_id from, Message * msg)
+{
+    TaskStruct * task = self;
+    if (RC_FAIL(receive_commit(task))) {
+        return -1;
+    }
+    int rc;
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        rc = ring_receive(task, from, msg);
+        break;
+    case TRANSPORT_INBOX:
+        rc = inbox_receive(task, from, msg);
+        break;
+    case TRANSPORT_URING:
+        rc = uring_receive(task, from, msg);
+        break;
+    case TRANSPORT_SEQPACKET:
+        rc = seqpacket_receive(task, from, msg);
+        break;
+    default:
+        rc = pipe_receive(task, from, msg);
+        break;
+    }
+    if (RC_FAIL(rc)) {
+        return -1;
+    }
+
+    // broadcast forwarded by this peer is delivered as its message
+    (void)tree_accept(task, from, msg);
+    slab_resolve(task, msg);
+    if (task->latency != NULL) {
+        latency_record(task, msg);
+    }
+    log_message(task, from, from, msg, INCOMING);
+    return 0;
+}
+
 int receive(void * self, local_id from, Message * msg)
+{
+    return receive_from(self, from, msg);
+}
+
+int receive_any(void * self, Message * msg)
 {
     TaskStruct * task = self;
-    int fd = get_sender(task, from);
-    if (fd < 0) {
+    if (RC_FAIL(receive_commit(task))) {
+        return -1;
+    }
+    node_id from;
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        from = ring_receive_any(task, msg);
+        break;
+    case TRANSPORT_INBOX:
+        from = inbox_receive_any(task, msg);
+        break;
+    case TRANSPORT_URING:
+        from = uring_receive_any(task, msg);
+        break;
+    case TRANSPORT_SEQPACKET:
+        from = seqpacket_receive_any(task, msg);
+        break;
+    default:
+        from = pipe_receive_any(task, msg);
+        break;
+    }
+    if (from < 0) {
+        return -1;
+    }
+
+    node_id hop = from;
+    from = tree_accept(task, from, msg);
+    slab_resolve(task, msg);
+    if (task->latency != NULL) {
+        latency_record(task, msg);
+    }
+    log_message(task, hop, from, msg, INCOMING);
+    return from;
+}
+
+int receive_batch(void * self, Message * out, node_id * from, size_t max)
+{
+    TaskStruct * task = self;
+    if (max == 0) {
+        return 0;
+    }
+    // waiting for input ends the step, push out what it has sent
+    if (RC_FAIL(receive_commit(task))) {
         return -1;
     }
 
-    int err = read(fd, msg, sizeof(MessageHeader));
-    if (err <= 0) {
+    int n;
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        n = ring_receive_batch(task, out, from, max);
+        break;
+    case TRANSPORT_INBOX:
+        n = inbox_receive_batch(task, out, from, max);
+        break;
+    case TRANSPORT_URING:
+        n = uring_receive_batch(task, out, from, max);
+        break;
+    case TRANSPORT_SEQPACKET:
+        n = seqpacket_receive_batch(task, out, from, max);
+        break;
+    default:
+        n = pipe_receive_batch(task, out, from, max);
+        break;
+    }
+    if (n < 0) {
         return -1;
     }
 
-    err = read(fd, msg->s_payload, msg->s_header.s_payload_len);
-    if (err < 0) {
-        return err;
+    for (int i = 0; i < n; i++) {
+        node_id hop = from[i];
+        from[i] = tree_accept(task, from[i], &out[i]);
+        slab_resolve(task, &out[i]);
+        if (task->latency != NULL) {
+            latency_record(task, &out[i]);
+        }
+        log_message(task, hop, from[i], &out[i], INCOMING);
+    }
+    return n;
+}
+
+Message * receive_next(void * self, node_id * from)
+{
+    TaskStruct * task = self;
+    if (task->batch_pos == task->batch_len) {
+        if (task->batch == NULL) {
+            task->batch = malloc(sizeof(Message) * RECEIVE_BATCH_SIZE);
+            task->batch_from = malloc(sizeof(node_id) * RECEIVE_BATCH_SIZE);
+        }
+        int n = receive_batch(self, task->batch, task->batch_from, RECEIVE_BATCH_SIZE);
+        if (n < 0) {
+            return NULL;
+        }
+        task->batch_len = n;
+        task->batch_pos = 0;
+    }
+
+    *from = task->batch_from[task->batch_pos];
+    return &task->batch[task->batch_pos++];
+}
+
+const Message * receive_view(void * self, node_id * from)
+{
+    TaskStruct * task = self;
+    if (RC_FAIL(release_view(self))) {
+        return NULL;
+    }
+
+    // messages already taken by receive_next go first
+    if (task->batch_pos < task->batch_len) {
+        *from = task->batch_from[task->batch_pos];
+        return &task->batch[task->batch_pos++];
+    }
+
+    if (RC_FAIL(receive_commit(task))) {
+        return NULL;
+    }
+    if (task->view_buf == NULL && (task->view_buf = malloc(sizeof(Message))) == NULL) {
+        return NULL;
+    }
+
+    const Message * view;
+    node_id peer;
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        peer = ring_peek(task, task->view_buf, &view);
+        break;
+    case TRANSPORT_INBOX:
+        peer = inbox_peek(task, &view);
+        break;
+    case TRANSPORT_URING:
+        peer = uring_wait_frame(task);
+        view = (peer < 0) ? NULL : frame_peek(&task->channels[peer]);
+        break;
+    case TRANSPORT_SEQPACKET:
+        // packet leaves the socket as a whole, so it is read into the view buffer
+        peer = seqpacket_receive_any(task, task->view_buf);
+        view = task->view_buf;
+        break;
+    default:
+        peer = pipe_wait_frame(task);
+        view = (peer < 0) ? NULL : frame_peek(&task->channels[peer]);
+        break;
+    }
+    if (peer < 0) {
+        return NULL;
+    }
+    task->view_from = peer;
+    task->view_held = 1;
+
+    // rare enough to be unwrapped in a copy, transport frame stays intact
+    if (view->s_header.s_magic == TREE_MAGIC) {
+        if (view != task->view_buf) {
+            memcpy(task->view_buf, view, sizeof(MessageHeader) + view->s_header.s_payload_len);
+        }
+        peer = tree_accept(task, peer, task->view_buf);
+        view = task->view_buf;
+    }
+
+    const Message * slab = slab_peek(task, view);
+    if (slab != NULL) {
+        task->view_slab = slab;
+        view = slab;
+    }
+
+    // stamped frames are unwrapped in a copy as well, it's opt-in
+    if (task->latency != NULL && view->s_header.s_magic == LATENCY_MAGIC) {
+        if (view != task->view_buf) {
+            memcpy(task->view_buf, view, sizeof(MessageHeader) + view->s_header.s_payload_len);
+        }
+        latency_record(task, task->view_buf);
+        view = task->view_buf;
+    }
+
+    log_message(task, task->view_from, peer, view, INCOMING);
+    *from = peer;
+    return view;
+}
+
+int release_view(void * self)
+{
+    TaskStruct * task = self;
+    if (!task->view_held) {
+        return 0;
     }
+    task->view_held = 0;
 
-    pipe_log(task, from, msg, INCOMING);
+    if (task->view_slab != NULL) {
+        slab_drop(task, task->view_slab);
+        task->view_slab = NULL;
+    }
+
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        ring_drop(task, task->view_from);
+        break;
+    case TRANSPORT_INBOX:
+        inbox_drop(task);
+        break;
+    case TRANSPORT_SEQPACKET:
+        break;
+    default:
+        frame_drop(&task->channels[task->view_from]);
+        break;
+    }
     return 0;
 }
 
-int receive_any(void * self, Message * msg)
+int send_commit(void * self)
 {
     TaskStruct * task = self;
-    while (1) {
-        for (local_id from = 0; from < task->total_proc; from++) {
-            int err = receive(self, from, msg);
-            if (RC_OK(err)) {
-                return 0;
-            }
-            if (from == task->total_proc) {
-                from = 1;
-            }
+    if (task->transport == TRANSPORT_URING) {
+        return uring_commit(task);
+    }
+    if (task->transport == TRANSPORT_SHM) {
+        (void)ring_commit(task);
+        return 0;
+    }
+    if (task->transport != TRANSPORT_PIPE) {
+        return 0;
+    }
+
+    for (node_id dst = 0; dst < task->total_proc; dst++) {
+        if (dst == task->local_pid) {
+            continue;
+        }
+        Channel * ch = &task->channels[dst];
+        if (ch->out_len == 0 && !ch->out_polled) {
+            continue;
+        }
+        if (frame_flush(ch, get_recipient(task, dst)) < 0 ||
+            RC_FAIL(pipe_watch_output(task, dst))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int send_flush(void * self)
+{
+    TaskStruct * task = self;
+    if (task->binlog && RC_FAIL(binlog_flush())) {
+        return -1;
+    }
+    if (task->transport == TRANSPORT_URING) {
+        return uring_flush(task);
+    }
+    if (task->transport == TRANSPORT_SHM) {
+        return ring_flush(task);
+    }
+    if (task->transport != TRANSPORT_PIPE) {
+        // other transports never leave output behind
+        return 0;
+    }
+
+    for (node_id dst = 0; dst < task->total_proc; dst++) {
+        if (dst == task->local_pid) {
+            continue;
+        }
+        int fd = get_recipient(task, dst);
+        int rc;
+        while ((rc = frame_flush(&task->channels[dst], fd)) > 0) {
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            (void)poll(&pfd, 1, -1);
+        }
+        if (rc < 0 || RC_FAIL(pipe_watch_output(task, dst))) {
+            return -1;
         }
     }
+
+    return 0;
 }
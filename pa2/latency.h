@@ -0,0 +1,44 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+#include "ipc.h"
+#include "proc.h"
+
+/// Marks a frame carrying LatencyTrailer, the original magic is in the trailer
+#define LATENCY_MAGIC 0xAFB3
+
+/// Written by the parent at exit
+#define LATENCY_FILE "latency.log"
+
+typedef struct {
+    uint64_t s_sent;  ///< CLOCK_MONOTONIC ns at send
+    uint16_t s_magic; ///< magic of the message before stamping
+} __attribute__((packed)) LatencyTrailer;
+
+enum {
+    LATENCY_SUB_BITS = 5,                ///< 32 buckets per power of two, 3% apart
+    LATENCY_SUB = 1 << LATENCY_SUB_BITS,
+    LATENCY_MAX_EXP = 40,                ///< up to 2^41 ns, 36 minutes, longer go to the last bucket
+    LATENCY_BUCKETS = (LATENCY_MAX_EXP - LATENCY_SUB_BITS + 2) * LATENCY_SUB,
+    LATENCY_TYPES = CS_RELEASE + 1
+};
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint32_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+int latency_init(TaskStruct * task);
+
+/** Copy message with the send time appended
+ *
+ * @return out, or msg if the payload leaves no room for the trailer
+ */
+const Message * latency_stamp(const Message * msg, Message * out);
+
+/** Strip the trailer of a stamped message and record its latency */
+void latency_record(TaskStruct * task, Message * msg);
+#endif
@@ -10,13 +10,27 @@
 #include "common.h"
 #include "ipc.h"
 #include "pa2345.h"
+#include "binlog.h"
+#include "evlog.h"
+#include "ipc_ext.h"
+#include "latency.h"
 #include "pipes.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timeline.h"
+#include "workload.h"
 #include "proc.h"
 
 #define PA2_MAX(x,y) ((x > y)?x:y)
 
+// -x: messages carry ExtTrailer, the way pa3 and pa4 stamp them
+int g_ext = 0;
+
 int event_log(TaskStruct * this, const char * msg, int length)
 {
+    if (this->evlog) {
+        return evlog_append(this->local_pid, get_physical_time(), msg, length);
+    }
     write(STDOUT_FILENO, msg, length);
     return (write(this->events_log_fd, msg, length) < 0) ? -1 : 0;
 }
@@ -29,9 +43,9 @@ int create_message(Message * msg, MessageType type, const MessagePayload * paylo
     header.s_local_time = get_physical_time();
 
     if (payload == NULL) {
-        msg->s_header.s_payload_len = 0;
         msg->s_header = header;
-        return 0;
+        msg->s_header.s_payload_len = 0;
+        return g_ext ? ext_wrap(msg, header.s_local_time, msg) : 0;
     }
 
     if (payload->s_size > MAX_PAYLOAD_LEN) {
@@ -41,7 +55,20 @@ int create_message(Message * msg, MessageType type, const MessagePayload * paylo
 
     msg->s_header = header;
     memcpy(msg->s_payload, payload->s_data, payload->s_size);
-    return 0;
+    return g_ext ? ext_wrap(msg, header.s_local_time, msg) : 0;
+}
+
+/**
+ * Stamp a message made by create_message with given time
+ *
+ * @return 0 on success, -1 if the payload leaves no room for the trailer
+ */
+static int stamp_message(Message * msg, timestamp_t time)
+{
+    msg->s_header.s_payload_len = ext_payload_len(msg);
+    msg->s_header.s_magic = MESSAGE_MAGIC;
+    msg->s_header.s_local_time = time;
+    return g_ext ? ext_wrap(msg, time, msg) : 0;
 }
 
 void transfer(void * parent_data, local_id src, local_id dst, balance_t amount)
@@ -65,12 +92,25 @@ void transfer(void * parent_data, local_id src, local_id dst, balance_t amount)
         send(this, src, &msg);
     }
     else {
+        if (this->transfer_queue_len == this->transfer_queue_cap) {
+            this->transfer_queue_cap = this->transfer_queue_cap ? 2 * this->transfer_queue_cap : this->total_proc;
+            this->transfer_queue = realloc(this->transfer_queue, sizeof(Message) * this->transfer_queue_cap);
+            if (this->transfer_queue == NULL) {
+                perror("transfer queue realloc error");
+                exit(EXIT_FAILURE);
+            }
+        }
         this->transfer_queue[this->transfer_queue_len++] = msg;
     }
 }
 
 timestamp_t push_history(BalanceHistory * history, timestamp_t last_time, balance_t balance, balance_t incoming, timestamp_t time)
 {
+    // a long workload outruns the history, later states aren't kept;
+    // s_history_len is 8-bit, so the last one is at MAX_T - 1
+    if (time < 0 || time >= MAX_T) {
+        return last_time;
+    }
     for (timestamp_t i = last_time; i < time; i++) {
         history->s_history[i] = (BalanceState){balance, i, 0};
     }
@@ -100,6 +140,23 @@ enum department_state {
 };
 typedef enum department_state department_state;
 
+// names for the timeline, in the order of department_state
+static const char * department_state_names[] = {
+    "d_initial",
+    "d_send_started",
+    "d_handle_messages",
+    "d_handle_out_transfer",
+    "d_handle_in_transfer",
+    "d_handle_stop",
+    "d_handle_done",
+    "d_send_transfer",
+    "d_send_ack",
+    "d_send_done",
+    "d_all_done",
+    "d_failed_finish",
+    "d_finish"
+};
+
 void department_fsm(TaskStruct * this)
 {
     department_state state = d_initial;
@@ -108,14 +165,18 @@ void department_fsm(TaskStruct * this)
     char log_msg[MAX_PAYLOAD_LEN];
 
     int done_n = 0;
+    int stopped = 0;
 
     int next = 1;
     while (next) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, department_state_names[state], get_physical_time());
+        }
+        stats_state(state, department_state_names[state]);
         switch (state) {
         case d_initial: {
             close_redundant_pipes(this);
 
-            msg = malloc(sizeof(Message));
             state = d_send_started;
         } break;
         case d_send_started: {
@@ -133,18 +194,23 @@ void department_fsm(TaskStruct * this)
                 continue;
             }
             MessagePayload payload = (MessagePayload) { log_msg, symb + 1 };
-            if (RC_FAIL(create_message(msg, STARTED, &payload))) {
+            Message started;
+            if (RC_FAIL(create_message(&started, STARTED, &payload))) {
                 printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
                 state = d_failed_finish;
                 continue;
             }
-            send(this, 0 /* is always manager */, msg);
+            send(this, 0 /* is always manager */, &started);
 
             state = d_handle_messages;
         } break;
         case d_handle_messages: {
-            int status = receive_any(this, msg);
-            if (RC_OK(status)) {
+            // slot of the received batch, states below may reuse it
+            // as scratch until the next receive_next
+            node_id from;
+            Message * in = receive_next(this, &from);
+            if (in != NULL) {
+                msg = in;
                 switch (msg->s_header.s_type) {
                 case DONE:
                     state = d_handle_done;
@@ -161,8 +227,12 @@ void department_fsm(TaskStruct * this)
         } break;
         case d_handle_out_transfer: {
             TransferOrder * order = (TransferOrder *)msg->s_payload;
-            msg->s_header.s_local_time = get_physical_time();
-            timestamp_t time = msg->s_header.s_local_time;
+            if (RC_FAIL(stamp_message(msg, get_physical_time()))) {
+                printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
+                state = d_failed_finish;
+                continue;
+            }
+            timestamp_t time = ext_time(msg);
             this->last_time = push_history(&this->history, this->last_time, this->balance, -order->s_amount, time);
             this->balance -= order->s_amount;
 
@@ -182,7 +252,7 @@ void department_fsm(TaskStruct * this)
         } break;
         case d_handle_in_transfer: {
             TransferOrder * order = (TransferOrder *)msg->s_payload;
-            timestamp_t time = msg->s_header.s_local_time;
+            timestamp_t time = ext_time(msg);
             this->last_time = push_history(&this->history, this->last_time, this->balance, order->s_amount, time);
             this->balance += order->s_amount;
 
@@ -201,13 +271,15 @@ void department_fsm(TaskStruct * this)
             state = d_send_ack;
         } break;
         case d_handle_stop: {
+            stopped = 1;
             state = d_send_done;
         } break;
         case d_handle_done: {
             state = d_handle_messages;
 
             done_n++;
-            if (done_n == this->total_proc - 2) { //except manager and himself
+            //DONE of others may overtake our STOP
+            if (done_n == this->total_proc - 2 && stopped) { //except manager and himself
                 state = d_all_done;
             }
         } break;
@@ -246,7 +318,7 @@ void department_fsm(TaskStruct * this)
             }
 
             send_multicast(this, msg);
-            state = d_handle_messages;
+            state = (done_n == this->total_proc - 2) ? d_all_done : d_handle_messages;
         } break;
         case d_all_done: {
             state = d_finish;
@@ -266,7 +338,8 @@ void department_fsm(TaskStruct * this)
 
             int balance_size = sizeof(BalanceHistory) - sizeof(this->history.s_history) + sizeof(BalanceState) * this->history.s_history_len;
             MessagePayload payload = (MessagePayload){(char *)&this->history, balance_size};
-            if (RC_FAIL(create_message(msg, BALANCE_HISTORY, &payload))) {
+            // at the time of the last state, the manager tells a cut history by it
+            if (RC_FAIL(create_message(msg, BALANCE_HISTORY, &payload)) || RC_FAIL(stamp_message(msg, time))) {
                 printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
                 state = d_failed_finish;
                 continue;
@@ -278,12 +351,28 @@ void department_fsm(TaskStruct * this)
             exit(EXIT_FAILURE);
         } break;
         case d_finish: {
+            send_flush(this);
             exit(EXIT_SUCCESS);
         } break;
         }
     }
 }
 
+/*
+ * print_history takes AllHistory of MAX_PROCESS_ID + 1 departments,
+ * more of them are printed in several tables
+ */
+void print_all_history(const BalanceHistory * histories, int len)
+{
+    AllHistory all_history;
+    for (int off = 0; off < len; off += MAX_PROCESS_ID + 1) {
+        int chunk = (len - off < MAX_PROCESS_ID + 1) ? len - off : MAX_PROCESS_ID + 1;
+        all_history.s_history_len = chunk;
+        memcpy(all_history.s_history, histories + off, sizeof(BalanceHistory) * chunk);
+        print_history(&all_history);
+    }
+}
+
 /*
  * FSM for transfer manage
  */
@@ -304,28 +393,53 @@ enum manager_state {
 };
 typedef enum manager_state manager_state;
 
+// names for the timeline, in the order of manager_state
+static const char * manager_state_names[] = {
+    "m_initial",
+    "m_handle_messages",
+    "m_handle_started",
+    "m_handle_done",
+    "m_handle_ack",
+    "m_handle_balance_history",
+    "m_send_stop",
+    "m_all_started",
+    "m_all_done",
+    "m_all_balances",
+    "m_failed_finish",
+    "m_finish"
+};
+
 void manager_fsm(TaskStruct * this)
 {
     manager_state state = m_initial;
 
-    Message * msg;
-    AllHistory all_history = {0};
+    const Message * msg;
+    Message out;
+    // one slot per department, AllHistory holds MAX_PROCESS_ID + 1 at most
+    BalanceHistory * histories = calloc(this->total_proc - 1, sizeof(BalanceHistory));
+    int histories_len = 0;
     char log_msg[MAX_PAYLOAD_LEN];
 
     int started_n = 0;
     int done_n = 0;
+    int truncated = 0;
 
     int next = 1;
     while (next) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, manager_state_names[state], get_physical_time());
+        }
+        stats_state(state, manager_state_names[state]);
         switch (state) {
         case m_initial: {
-            msg = malloc(sizeof(Message));
             state = m_handle_messages;
             this->transfer_queue_ack = 1;
         } break;
         case m_handle_messages: {
-            int status = receive_any(this, msg);
-            if (RC_OK(status)) {
+            // read in place, the view is released by the next receive_view
+            node_id from;
+            msg = receive_view(this, &from);
+            if (msg != NULL) {
                 switch (msg->s_header.s_type) {
                 case STARTED:
                     state = m_handle_started;
@@ -360,23 +474,35 @@ void manager_fsm(TaskStruct * this)
         } break;
         case m_handle_ack: {
             state = m_handle_messages;
-            const Message * msg = &this->transfer_queue[this->transfer_queue_index];
-            const TransferOrder * order = (const TransferOrder *)msg->s_payload;
-            this->transfer_queue_index++;
+            if (this->workload != NULL) {
+                workload_ack(this);
+            }
             this->transfer_queue_ack = 1;
-            if (this->transfer_queue_index > this->transfer_queue_len) {
-                state = m_send_stop;
+            if (this->transfer_queue_index == this->transfer_queue_len) {
+                // queue is drained, start it over for the next burst if any
+                this->transfer_queue_index = 0;
+                this->transfer_queue_len = 0;
+                if (this->workload == NULL || workload_next(this) == 0) {
+                    state = m_send_stop;
+                }
                 continue;
             }
+            const Message * msg = &this->transfer_queue[this->transfer_queue_index++];
+            const TransferOrder * order = (const TransferOrder *)msg->s_payload;
             send(this, order->s_src, msg);
         } break;
         case m_handle_balance_history: {
             state = m_handle_messages;
 
-            BalanceHistory * history = (BalanceHistory *)msg->s_payload;
-            all_history.s_history[all_history.s_history_len++] = *history;
+            // only the filled part of the history travels in the payload
+            const BalanceHistory * history = (const BalanceHistory *)msg->s_payload;
+            size_t len = ext_payload_len(msg) < sizeof(*history) ? ext_payload_len(msg) : sizeof(*history);
+            memcpy(&histories[histories_len++], history, len);
+            if (this->workload != NULL) {
+                workload_history(this, ext_time(msg));
+            }
 
-            if (all_history.s_history_len == this->total_proc - 1) {
+            if (histories_len == this->total_proc - 1) {
                 state = m_all_balances;
             }
         } break;
@@ -391,16 +517,21 @@ void manager_fsm(TaskStruct * this)
                 perror("event_log failed");
                 state = m_failed_finish;
             }
-            bank_robbery(this, this->total_proc - 1);
+            if (this->workload == NULL) {
+                bank_robbery(this, this->total_proc - 1);
+            }
+            else if (RC_FAIL(workload_start(this))) {
+                state = m_failed_finish;
+            }
         } break;
         case m_send_stop: {
-            if (RC_FAIL(create_message(msg, STOP, NULL))) {
+            if (RC_FAIL(create_message(&out, STOP, NULL))) {
                 printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
                 state = m_failed_finish;
                 continue;
             }
 
-            send_multicast(this, msg);
+            send_multicast(this, &out);
             state = m_handle_messages;
         } break;
         case m_all_done: {
@@ -416,7 +547,11 @@ void manager_fsm(TaskStruct * this)
             state = m_handle_messages;
         } break;
         case m_all_balances: {
-            print_history(&all_history);
+            print_all_history(histories, histories_len);
+            if (this->workload != NULL && (truncated = workload_finish(this)) < 0) {
+                state = m_failed_finish;
+                continue;
+            }
 
             state = m_finish;
         } break;
@@ -424,13 +559,14 @@ void manager_fsm(TaskStruct * this)
             exit(EXIT_FAILURE);
         } break;
         case m_finish: {
-            for (local_id i = 0; i < this->total_proc - 1; i++) {
+            send_flush(this);
+            for (node_id i = 0; i < this->total_proc - 1; i++) {
                 if (wait(NULL) == -1) {
                     perror("wait error");
                     exit(EXIT_FAILURE);
                 }
             }
-            exit(EXIT_SUCCESS);
+            exit(truncated ? EXIT_FAILURE : EXIT_SUCCESS);
         } break;
         }
     }
@@ -443,60 +579,131 @@ int main(int argc, char * argv[])
         return 1;
     }
     int proc_count = 0;
-    switch (getopt(argc, argv, "p:")) {
-    case 'p':
-        proc_count = atoi(optarg);
-        break;
-    case -1:
-        exit(EXIT_FAILURE);
-    case '?':
-        exit(EXIT_FAILURE);
+    int transport = TRANSPORT_PIPE;
+    int multicast = MULTICAST_FLAT;
+    int spawn_type = SPAWN_FLAT;
+    int lazy = 0;
+    int binlog = 0;
+    int evlog = 0;
+    int timeline = 0;
+    int stats = 0;
+    int latency = 0;
+    Workload * workload = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:m:s:lxBELSHW:")) != -1) {
+        switch (opt) {
+        case 'p':
+            proc_count = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            if ((multicast = multicast_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown multicast %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            if ((spawn_type = spawn_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown spawn %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            lazy = 1;
+            break;
+        case 'x':
+            g_ext = 1;
+            break;
+        case 'B':
+            binlog = 1;
+            break;
+        case 'E':
+            evlog = 1;
+            break;
+        case 'L':
+            timeline = 1;
+            break;
+        case 'S':
+            stats = 1;
+            break;
+        case 'H':
+            latency = 1;
+            break;
+        case 'W':
+            if ((workload = workload_parse(optarg)) == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case '?':
+            exit(EXIT_FAILURE);
+        }
     }
 
-    if (proc_count <= 0 || proc_count > 10) {
+    // TransferOrder and BalanceHistory carry 8-bit ids even with -x
+    if (proc_count <= 0 || proc_count > (g_ext ? INT8_MAX : 10)) {
         fprintf(stderr, "Invalid amount of child processes to create\n");
         exit(EXIT_FAILURE);
     }
 
-#define ARG_OFFSET 3
-    if (proc_count + ARG_OFFSET != argc) {
+    //balances follow the options
+    char ** balances = argv + optind;
+    if (proc_count != argc - optind) {
         fprintf(stderr, "Bad list of balances for given amount of processes\n");
         exit(EXIT_FAILURE);
     }
+    if (workload != NULL && RC_FAIL(workload_balances(workload, balances, proc_count))) {
+        exit(EXIT_FAILURE);
+    }
 
     TaskStruct task = {0};
     task.total_proc = proc_count + 1;
     task.local_pid = 0;
-
-    if ((task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    task.transport = transport;
+    task.multicast = multicast;
+    task.spawn = spawn_type;
+    task.lazy = lazy;
+    task.binlog = binlog;
+    task.evlog = evlog;
+    task.timeline = timeline;
+    task.workload = workload;
+
+    // with segments events.log is made by evlog_merge
+    task.events_log_fd = -1;
+    if (!evlog && (task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("events log open error");
         exit(EXIT_FAILURE);
     }
-    if ((task.pipe_log_fd = open(pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    if ((task.pipe_log_fd = open(binlog ? BINLOG_FILE : pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("pipe log open error");
         exit(EXIT_FAILURE);
     }
 
+    if (stats && RC_FAIL(stats_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
+    if (latency && RC_FAIL(latency_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
     if (RC_FAIL(pipe_init(&task))) {
         perror("pipe init failed");
         exit(EXIT_FAILURE);
     }
 
-    for (local_id i = 1; i < task.total_proc; i++) {
-        switch (fork()) {
-        case -1:
-            perror("fork error");
-            exit(EXIT_FAILURE);
-        case 0: {
-            TaskStruct this = task;
-            this.local_pid = i;
-            this.history.s_id = i;
-            this.balance = atoi(argv[i + ARG_OFFSET - 1]);
-            department_fsm(&this);
-        } break;
-        default:
-            break;
-        }
+    node_id id = spawn(&task);
+    if (id < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (id != PARENT_ID) {
+        TaskStruct this = task;
+        this.local_pid = id;
+        this.history.s_id = id;
+        this.balance = atoi(balances[id - 1]);
+        department_fsm(&this);
     }
 
     close_redundant_pipes(&task);
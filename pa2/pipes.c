@@ -3,8 +3,19 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <sys/epoll.h>
 
+#include "binlog.h"
+#include "broker.h"
+#include "frame.h"
+#include "inbox.h"
 #include "pipes.h"
+#include "ring.h"
+#include "seqpacket.h"
+#include "slab.h"
+#include "spawn.h"
+#include "stats.h"
+#include "uring.h"
 
 /* Pipe descriptors storage
  * Here is N processes
@@ -64,13 +75,40 @@ int test_pipes(TaskStruct * task)
 
 int pipe_init(TaskStruct * task)
 {
+    if (RC_FAIL(slab_init(task))) {
+        return -1;
+    }
+
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        return ring_init(task);
+    case TRANSPORT_INBOX:
+        return inbox_init(task);
+    case TRANSPORT_SEQPACKET:
+        return seqpacket_init(task);
+    default:
+        break;
+    }
+
+    if (task->lazy && task->transport != TRANSPORT_PIPE) {
+        fprintf(stderr, "lazy channels work with pipe transport only, building the full mesh\n");
+        task->lazy = 0;
+    }
+
     int n = task->total_proc;
     task->pipes = (int(*)[2])malloc(sizeof(int) * 2 * 2 * n * (n - 1));
     int(*pipes)[2] = task->pipes;
     int fdp = 0;
-    for (local_id i = 0; i < n; i++) {     //master_proc_id
-        for (local_id j = 0; j < n; j++) { //slave_proc_id
-            if (j > i) {
+    for (node_id i = 0; i < n; i++) {     //master_proc_id
+        for (node_id j = 0; j < n; j++) { //slave_proc_id
+            if (j > i && task->lazy && i != PARENT_ID) {
+                //brokered by the parent on first use
+                pipes[fdp][0] = pipes[fdp][1] = -1;
+                fdp++;
+                pipes[fdp][0] = pipes[fdp][1] = -1;
+                fdp++;
+            }
+            else if (j > i) {
                 if (RC_FAIL(pipe2(pipes[fdp++], O_NONBLOCK)))
                     return -1;
                 if (RC_FAIL(pipe2(pipes[fdp++], O_NONBLOCK)))
@@ -83,10 +121,10 @@ int pipe_init(TaskStruct * task)
         }
     }
 
-    return 0;
+    return task->lazy ? broker_init(task) : 0;
 }
 
-int get_pipe(TaskStruct * task, local_id requested, local_id base)
+int get_pipe(TaskStruct * task, node_id requested, node_id base)
 {
     if (requested == base) {
         return -1;
@@ -101,112 +139,177 @@ int get_pipe(TaskStruct * task, local_id requested, local_id base)
     }
 }
 
-int close_rw_pipes(TaskStruct * task)
+/* Descriptors of other channels
+ *
+ * Process keeps the read end from and the write end to every peer,
+ * anything else in the matrix belongs to other pairs or is the far
+ * end of its own pipes. pipe2 hands fds out in a row, so the ones to
+ * drop form a few long runs between kept fds: they are marked in a
+ * bitmap and each run goes with one close_range instead of closing
+ * channel after channel.
+ */
+static int close_mesh(TaskStruct * task)
 {
-    //Position of current process fds in pid's fds block
-    int block_size = 2 * (task->total_proc - 1);
-    int block = task->local_pid * block_size;
-    int block_end = block + block_size;
-
-    for (int i = block; i < block_end; i++) {
-        if (close(task->pipes[i][i % 2])) {
-            perror("close_rw_pipes close error");
-            return 1;
+    int entries = 2 * task->total_proc * (task->total_proc - 1);
+    int(*pipes)[2] = task->pipes;
+
+    int max = -1;
+    for (int i = 0; i < entries; i++) {
+        max = (pipes[i][0] > max) ? pipes[i][0] : max;
+        max = (pipes[i][1] > max) ? pipes[i][1] : max;
+    }
+    if (max < 0) {
+        return 0;
+    }
+
+    char * drop = calloc(max + 1, 1);
+    if (drop == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < entries; i++) {
+        //lazy channels are -1
+        for (int end = 0; end < 2; end++) {
+            if (pipes[i][end] >= 0) {
+                drop[pipes[i][end]] = 1;
+            }
+        }
+    }
+    for (node_id peer = 0; peer < task->total_proc; peer++) {
+        if (peer == task->local_pid) {
+            continue;
+        }
+        int slot = get_pipe(task, peer, task->local_pid);
+        if (pipes[slot + 1][0] >= 0) {
+            drop[pipes[slot + 1][0]] = 0;
+            drop[pipes[slot][1]] = 0;
         }
     }
 
-    return 0;
+    int rc = close_fds(drop, max + 1);
+    free(drop);
+    return (rc < 0) ? -1 : 0;
 }
 
 int close_redundant_pipes(TaskStruct * task)
 {
-    local_id max_pid = task->total_proc;
-    int(*pipes)[2] = task->pipes;
-    int block_size = 2 * (max_pid - 1);
+    // first thing a process does on its own, its counters start here
+    if (task->stats != NULL && RC_FAIL(stats_attach(task))) {
+        return -1;
+    }
 
-    for (local_id pid = 0; pid < max_pid; pid++) {
-        if (pid == task->local_pid) { //fds for current process
-            continue;
-        }
+    switch (task->transport) {
+    case TRANSPORT_SHM:
+        // shared mapping is all there is, nothing to close
+        return ring_attach(task);
+    case TRANSPORT_INBOX:
+        return inbox_attach(task);
+    case TRANSPORT_SEQPACKET:
+        return seqpacket_attach(task);
+    default:
+        break;
+    }
 
-        //For each process descriptor block (PDB)
-        //Need to close descriptors which have no
-        //duplicated in current process PDB
-
-        //for this line don't need to check for -1
-        //since checked for this condition above
-        //Position of current process fds in pid's fds block
-        int lid_pos = get_pipe(task, task->local_pid, pid);
-        //start of pid's fds block
-        int fdp = pid * block_size;
-        //end of pid's fds block
-        int max_fdp = fdp + block_size;
-
-        for (; fdp < max_fdp; fdp += 2) {
-            if (fdp == lid_pos || pipes[fdp][0] == -1) {
-                //mustn't be closed because they are duplicated in
-                //current process block
-                //
-                //or closed already
-                continue;
-            }
+    if (RC_FAIL(close_mesh(task))) {
+        perror("close_redundant_pipes close error");
+        return -1;
+    }
+    if (RC_FAIL(channel_init(task)) || RC_FAIL(poll_init(task))) {
+        perror("channel_init error");
+        return -1;
+    }
+    // channel table holds everything this process needs from the matrix
+    free(task->pipes);
+    task->pipes = NULL;
+    if (task->lazy && RC_FAIL(broker_attach(task))) {
+        return -1;
+    }
 
-            //Close redundant fdps related to communication between
-            //pid and set of all processes except this one
-            if (close(pipes[fdp][0]) || close(pipes[fdp][1]) ||
-                close(pipes[fdp + 1][0]) || close(pipes[fdp + 1][1])) {
-                printf("%d\n", task->local_pid);
-                perror("close_redundant_pipes close error");
-            }
+    // same pipes and frames on the wire, so peers may differ here
+    if (task->transport == TRANSPORT_URING && RC_FAIL(uring_init(task))) {
+        fprintf(stderr, "process %d: io_uring is unavailable, staying on pipes\n", task->local_pid);
+        task->transport = TRANSPORT_PIPE;
+    }
+    return 0;
+}
 
-            //For which process fds were closed
-            //
-            //This is pid's fds block
+/* Readiness set of the current process
+ *
+ * Every incoming fd left after close_redundant_pipes
+ * is registered in one epoll instance with sender id
+ * stored in event data, so receive_any can sleep until
+ * some channel is readable and then visit only ready ones
+ */
+int poll_init(TaskStruct * task)
+{
+    task->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (task->epoll_fd < 0) {
+        perror("poll_init epoll_create1 error");
+        return -1;
+    }
 
-            local_id closed_id;
-            int offset = fdp % block_size / 2;
-            if (offset == 0) {
-                closed_id = 1;
-            }
-            else {
-                closed_id = offset;
-                if (pid <= closed_id) {
-                    closed_id++;
-                }
-            }
+    // incoming ends plus write ends with pending output
+    task->ready = malloc(sizeof(struct epoll_event) * 2 * task->total_proc);
+    task->ready_len = 0;
+    task->ready_pos = 0;
+
+    for (node_id from = 0; from < task->total_proc; from++) {
+        int fd = get_sender(task, from);
+        if (fd < 0) {
+            continue;
+        }
 
-            int tip = get_pipe(task, pid, closed_id);
-            pipes[tip][0] = pipes[tip][1] = pipes[tip + 1][0] = pipes[tip + 1][1] = -1;
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u32 = from;
+        if (RC_FAIL(epoll_ctl(task->epoll_fd, EPOLL_CTL_ADD, fd, &event))) {
+            perror("poll_init epoll_ctl error");
+            return -1;
         }
     }
 
-    close_rw_pipes(task);
     return 0;
 }
 
-int get_recipient(TaskStruct * task, local_id dst)
+int transport_parse(const char * name)
 {
-    if (dst == task->local_pid) {
-        return -1;
+    if (strcmp(name, "pipe") == 0) {
+        return TRANSPORT_PIPE;
     }
-
-    return task->pipes[get_pipe(task, dst, task->local_pid)][1];
+    if (strcmp(name, "shm") == 0) {
+        return TRANSPORT_SHM;
+    }
+    if (strcmp(name, "inbox") == 0) {
+        return TRANSPORT_INBOX;
+    }
+    if (strcmp(name, "uring") == 0) {
+        return TRANSPORT_URING;
+    }
+    if (strcmp(name, "seqpacket") == 0) {
+        return TRANSPORT_SEQPACKET;
+    }
+    return -1;
 }
 
-int get_sender(TaskStruct * task, local_id from)
+int multicast_parse(const char * name)
 {
-    if (from == task->local_pid) {
-        return -1;
+    if (strcmp(name, "flat") == 0) {
+        return MULTICAST_FLAT;
     }
-
-    return task->pipes[get_pipe(task, from, task->local_pid) + 1][0];
+    if (strcmp(name, "tree") == 0) {
+        return MULTICAST_TREE;
+    }
+    return -1;
 }
 
 /**
  * @param direction 0 - if incoming, 1 - if outcoming
  */
-int pipe_log(TaskStruct * task, local_id pid, const Message * msg, int direction)
+int pipe_log(TaskStruct * task, node_id pid, const Message * msg, int direction)
 {
+    if (task->binlog) {
+        return binlog_append(task->pipe_log_fd, task->local_pid, pid, msg, direction);
+    }
+
     char log_msg[128] = {0};
     int len = sprintf(log_msg, "[%d %c %d] ", task->local_pid, (direction) ? '>' : '<', pid);
 
@@ -243,7 +346,11 @@ int pipe_log(TaskStruct * task, local_id pid, const Message * msg, int direction
         len += sprintf(log_msg + len, "CS_RELEASE\n");
         break;
     }
-    if (RC_FAIL(write(task->pipe_log_fd, log_msg, len))) {
+    if (task->transport == TRANSPORT_URING) {
+        return uring_log(task, log_msg, len);
+    }
+    stats_syscall();
+    if (write(task->pipe_log_fd, log_msg, len) < 0) {
         return -1;
     }
 
@@ -1,7 +1,10 @@
 #ifndef __IFMO_DISTRIBUTED_CLASS_PROC__H
 #define __IFMO_DISTRIBUTED_CLASS_PROC__H
 
+#include <sys/epoll.h>
+
 #include "ipc.h"
+#include "ipc_ext.h"
 #include "banking.h"
 
 
@@ -10,13 +13,114 @@
 #define RC_OK(x) (x == 0)
 #define RC_FAIL(x) !(RC_OK(x))
 
+typedef enum {
+    TRANSPORT_PIPE = 0, ///< N * (N - 1) nonblocking pipes
+    TRANSPORT_SHM,      ///< SPSC rings in memory shared before fork
+    TRANSPORT_INBOX,    ///< one pipe per process written by all peers
+    TRANSPORT_URING,    ///< pipe mesh driven through io_uring
+    TRANSPORT_SEQPACKET ///< unix seqpacket socketpair per pair of processes
+} TransportType;
+
+typedef enum {
+    MULTICAST_FLAT = 0, ///< sender writes to every peer
+    MULTICAST_TREE      ///< peers forward along a binomial tree
+} MulticastType;
+
+typedef enum {
+    SPAWN_FLAT = 0, ///< parent forks every child
+    SPAWN_TREE      ///< children fork their subtrees, O(log N) levels
+} SpawnType;
+
 typedef struct TaskStruct TaskStruct;
+typedef struct Channel Channel;
+typedef struct Uring Uring;
+typedef struct Workload Workload;
 struct TaskStruct
 {
-    local_id local_pid;
-    local_id total_proc;
+    node_id local_pid;
+    node_id total_proc;
+    TransportType transport;
+    MulticastType multicast;
+    SpawnType spawn;
     int (*pipes)[2];
 
+    /*
+     * SHARED MEMORY TRANSPORT
+     */
+    void * shm;
+    size_t shm_size;
+    node_id ring_next;
+    int ring_spin;
+    Channel * ring_out; ///< frames waiting for room in the ring, indexed by peer
+
+    /*
+     * INBOX TRANSPORT
+     */
+    int (*inboxes)[2];
+    char * inbox_buf;
+    size_t inbox_len;
+
+    /*
+     * SEQPACKET TRANSPORT, N * N MATRIX OF SOCKETS
+     */
+    int * sockets;
+
+    /*
+     * SHARED SLABS FOR MULTICAST, MAPPED WHEN THERE ARE 2+ RECEIVERS
+     */
+    void * slabs;
+    size_t slabs_size;
+    int slab_next;
+
+    /*
+     * LAZY PIPE MESH, CHANNELS BROKERED BY THE PARENT ON FIRST USE
+     */
+    int lazy;
+    int (*brokers)[2]; ///< control socket per child
+    char * brokered;   ///< parent only, N * N flags of channels set up
+
+    /*
+     * FRAMING AND PENDING OUTPUT OF PIPE CHANNELS, INDEXED BY PEER
+     */
+    Channel * channels;
+    Uring * uring;
+
+    /*
+     * MESSAGES OF THE LAST RECEIVE_BATCH HANDED OUT BY RECEIVE_NEXT
+     */
+    Message * batch;
+    node_id * batch_from;
+    int batch_len;
+    int batch_pos;
+
+    /*
+     * LIVE COUNTERS IN STATS_FILE, MAPPED BEFORE FORK
+     */
+    void * stats;
+    size_t stats_size;
+
+    /*
+     * SEND TO RECEIVE LATENCY HISTOGRAMS OF EVERY PROCESS, MAPPED BEFORE FORK
+     */
+    void * latency;
+    size_t latency_size;
+
+    /*
+     * MESSAGE HANDED OUT BY RECEIVE_VIEW
+     */
+    node_id view_from;
+    int view_held;                ///< transport frame to drop on release_view
+    const Message * view_slab;    ///< slab message to drop reference of
+    Message * view_buf;           ///< frame copied out of the transport for a view
+
+    /*
+     * RECEIVE_ANY READINESS
+     */
+    int epoll_fd;
+    struct epoll_event * ready;
+    int ready_len;
+    int ready_pos;
+
     balance_t balance;
     timestamp_t last_time;
     BalanceHistory history;
@@ -25,13 +129,18 @@ struct TaskStruct
     int transfer_queue_ack;
     int transfer_queue_len;
     int transfer_queue_index;
-    Message transfer_queue[MAX_T + 1];
+    int transfer_queue_cap;
+    Message * transfer_queue; ///< grows with the number of transfers
+    Workload * workload;      ///< -W, issues transfers in place of bank_robbery
 
     /*
      * LOGGING
      */
     int pipe_log_fd;
+    int binlog;   ///< pipe_log_fd is pipes.bin with binary records
     int events_log_fd;
+    int evlog;    ///< events go to the segment of the process, see evlog.c
+    int timeline; ///< sends, receives and states go to timeline.<id>.bin
 };
 
 typedef struct MessagePayload MessagePayload;
@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// send() of libc would clash with send() of ipc.h, only recvmmsg is used here
+#define send libc_send
+#include <sys/socket.h>
+#undef send
+
+#include "pipes.h"
+#include "seqpacket.h"
+#include "spawn.h"
+#include "stats.h"
+
+/* Seqpacket transport
+ *
+ * Every pair of processes shares one socketpair(AF_UNIX, SOCK_SEQPACKET),
+ * so there are N * (N - 1) / 2 pairs and each process holds N - 1
+ * sockets after seqpacket_attach, each used in both directions.
+ *
+ * Socket keeps message boundaries: a Message goes out in one write()
+ * and comes in with one recv(), so there is no framing state and no
+ * partial frames to wait for. Batch receive takes every queued
+ * message of a ready socket with one recvmmsg().
+ *
+ * Sockets are nonblocking, a writer facing a full socket waits
+ * for the peer to drain it, like the inbox transport does.
+ *
+ * Socket of process i for peer j is sockets[i * N + j].
+ */
+
+static int * socket_of(TaskStruct * task, node_id owner, node_id peer)
+{
+    return &task->sockets[owner * task->total_proc + peer];
+}
+
+int seqpacket_init(TaskStruct * task)
+{
+    int n = task->total_proc;
+    task->sockets = malloc(sizeof(int) * n * n);
+    for (node_id i = 0; i < n; i++) {
+        *socket_of(task, i, i) = -1;
+        for (node_id j = i + 1; j < n; j++) {
+            int sv[2];
+            if (RC_FAIL(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, sv))) {
+                return -1;
+            }
+            *socket_of(task, i, j) = sv[0];
+            *socket_of(task, j, i) = sv[1];
+        }
+    }
+
+    return 0;
+}
+
+int seqpacket_attach(TaskStruct * task)
+{
+    int n = task->total_proc;
+    int max = -1;
+    for (int i = 0; i < n * n; i++) {
+        max = (task->sockets[i] > max) ? task->sockets[i] : max;
+    }
+
+    // sockets of other processes, closed run by run
+    char * drop = calloc(max + 1, 1);
+    if (drop == NULL) {
+        return -1;
+    }
+    for (node_id owner = 0; owner < n; owner++) {
+        for (node_id peer = 0; peer < n; peer++) {
+            int * fd = socket_of(task, owner, peer);
+            if (owner == task->local_pid || *fd < 0) {
+                continue;
+            }
+            drop[*fd] = 1;
+            *fd = -1;
+        }
+    }
+    int rc = close_fds(drop, max + 1);
+    free(drop);
+    if (rc < 0) {
+        perror("seqpacket_attach close error");
+        return -1;
+    }
+
+    task->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (task->epoll_fd < 0) {
+        perror("seqpacket_attach epoll_create1 error");
+        return -1;
+    }
+    task->ready = malloc(sizeof(struct epoll_event) * n);
+    task->ready_len = 0;
+    task->ready_pos = 0;
+
+    for (node_id peer = 0; peer < n; peer++) {
+        if (peer == task->local_pid) {
+            continue;
+        }
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u32 = peer;
+        if (RC_FAIL(epoll_ctl(task->epoll_fd, EPOLL_CTL_ADD, *socket_of(task, task->local_pid, peer), &event))) {
+            perror("seqpacket_attach epoll_ctl error");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int seqpacket_send(TaskStruct * task, node_id dst, const Message * msg)
+{
+    if (dst == task->local_pid || dst < 0 || dst >= task->total_proc) {
+        return -1;
+    }
+
+    int fd = *socket_of(task, task->local_pid, dst);
+    stats_syscall();
+    while (write(fd, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len) < 0) {
+        stats_syscall();
+        if (errno == EAGAIN) {
+            // socket is full, wait for the peer to drain it
+            stats_eagain();
+            struct pollfd pfd = {fd, POLLOUT, 0};
+            (void)poll(&pfd, 1, -1);
+        }
+        else if (errno != EINTR) {
+            perror("seqpacket_send write error");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @return 1 if message was received, 0 if socket is empty,
+ *         -1 if the peer is gone or on error
+ */
+static int seqpacket_recv(TaskStruct * task, node_id from, Message * msg)
+{
+    stats_syscall();
+    ssize_t len = recv(*socket_of(task, task->local_pid, from), msg, sizeof(Message), MSG_DONTWAIT);
+    if (len >= (ssize_t)sizeof(MessageHeader)) {
+        return 1;
+    }
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        if (errno == EAGAIN) {
+            stats_eagain();
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Forget the socket of a peer that has closed its end,
+ * level triggered epoll would report it forever otherwise
+ */
+static void seqpacket_forget(TaskStruct * task, node_id peer)
+{
+    epoll_ctl(task->epoll_fd, EPOLL_CTL_DEL, *socket_of(task, task->local_pid, peer), NULL);
+}
+
+static int seqpacket_wait(TaskStruct * task)
+{
+    while (1) {
+        stats_syscall();
+        int n = epoll_wait(task->epoll_fd, task->ready, task->total_proc, -1);
+        if (n >= 0) {
+            task->ready_len = n;
+            task->ready_pos = 0;
+            return 0;
+        }
+        if (errno != EINTR) {
+            perror("seqpacket epoll_wait error");
+            return -1;
+        }
+    }
+}
+
+int seqpacket_receive(TaskStruct * task, node_id from, Message * msg)
+{
+    if (from == task->local_pid || from < 0 || from >= task->total_proc) {
+        return -1;
+    }
+    return (seqpacket_recv(task, from, msg) > 0) ? 0 : -1;
+}
+
+int seqpacket_receive_any(TaskStruct * task, Message * msg)
+{
+    while (1) {
+        // one message per ready socket to keep senders served in turn
+        while (task->ready_pos < task->ready_len) {
+            node_id peer = task->ready[task->ready_pos++].data.u32;
+            int rc = seqpacket_recv(task, peer, msg);
+            if (rc > 0) {
+                return peer;
+            }
+            if (rc < 0) {
+                seqpacket_forget(task, peer);
+            }
+        }
+
+        stats_empty_poll();
+        if (RC_FAIL(seqpacket_wait(task))) {
+            return -1;
+        }
+    }
+}
+
+int seqpacket_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max)
+{
+    struct iovec iov[RECEIVE_BATCH_SIZE];
+    struct mmsghdr vec[RECEIVE_BATCH_SIZE];
+
+    size_t n = 0;
+    while (1) {
+        while (n < max && task->ready_pos < task->ready_len) {
+            node_id peer = task->ready[task->ready_pos++].data.u32;
+
+            // whatever is queued on the socket, up to the room left
+            size_t want = (max - n < RECEIVE_BATCH_SIZE) ? max - n : RECEIVE_BATCH_SIZE;
+            memset(vec, 0, sizeof(vec[0]) * want);
+            for (size_t i = 0; i < want; i++) {
+                iov[i].iov_base = &out[n + i];
+                iov[i].iov_len = sizeof(Message);
+                vec[i].msg_hdr.msg_iov = &iov[i];
+                vec[i].msg_hdr.msg_iovlen = 1;
+            }
+
+            stats_syscall();
+            int got = recvmmsg(*socket_of(task, task->local_pid, peer), vec, want, MSG_DONTWAIT, NULL);
+            if (got < 0 && errno != EAGAIN && errno != EINTR) {
+                seqpacket_forget(task, peer);
+            }
+            for (int i = 0; i < got; i++) {
+                if (vec[i].msg_len == 0) {
+                    // peer has closed its end, the rest are empty reads
+                    seqpacket_forget(task, peer);
+                    break;
+                }
+                from[n++] = peer;
+            }
+        }
+
+        if (n > 0) {
+            return n;
+        }
+        stats_empty_poll();
+        if (RC_FAIL(seqpacket_wait(task))) {
+            return -1;
+        }
+    }
+}
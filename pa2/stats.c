@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/* Live counters of the run
+ *
+ * Parent maps STATS_FILE before fork, so every process of the run
+ * shares it:
+ *
+ *    +-------------+--------+--------+--     --+--------+
+ *    | StatsHeader | node 0 | node 1 |   ...   | node N |
+ *    +-------------+--------+--------+--     --+--------+
+ *
+ * A page holds messages and bytes per channel and per message type,
+ * EAGAIN of reads and writes, empty passes of the receive path,
+ * syscalls the transport made and time spent in every FSM state. Page of a process has a single
+ * writer, the process itself, so counters are plain increments with
+ * no locks and no atomics; a reader may see a count one message
+ * behind, which doesn't matter for rates. Pages start on page
+ * boundaries, processes never write to the same cache line.
+ *
+ * labstat maps the file read only and prints rates while the run
+ * goes on, or totals after it.
+ */
+
+StatsPage * stats_page = NULL;
+
+static uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int stats_init(TaskStruct * task)
+{
+    size_t page = sizeof(StatsPage) + sizeof(StatsCounters) * task->total_proc;
+    page = (page + STATS_PAGE - 1) / STATS_PAGE * STATS_PAGE;
+    size_t size = STATS_PAGE + page * task->total_proc;
+
+    int fd = open(STATS_FILE, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, MODE);
+    if (fd < 0 || RC_FAIL(ftruncate(fd, size))) {
+        perror("stats_init error");
+        return -1;
+    }
+    void * base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("stats_init mmap error");
+        return -1;
+    }
+
+    // file is fresh and zero filled, pages need the state only
+    StatsHeader * header = base;
+    header->nodes = task->total_proc;
+    header->page_size = page;
+    for (node_id id = 0; id < task->total_proc; id++) {
+        stats_page_of(base, id)->state = -1;
+    }
+    header->magic = STATS_MAGIC;
+
+    task->stats = base;
+    task->stats_size = size;
+    return 0;
+}
+
+int stats_attach(TaskStruct * task)
+{
+    stats_page = stats_page_of(task->stats, task->local_pid);
+    stats_page->pid = getpid();
+    return 0;
+}
+
+void stats_state(int state, const char * name)
+{
+    if (stats_page == NULL || stats_page->state == state) {
+        return;
+    }
+
+    uint64_t now = stats_now();
+    int prev = stats_page->state;
+    if (prev >= 0 && prev < STATS_STATES) {
+        stats_page->state_ns[prev] += now - stats_page->state_since;
+    }
+    if (state >= 0 && state < STATS_STATES && stats_page->state_names[state][0] == '\0') {
+        strncpy(stats_page->state_names[state], name, STATS_NAME_LEN - 1);
+    }
+    stats_page->state_since = now;
+    stats_page->state = state;
+}
@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipes.h"
+#include "timeline.h"
+
+/* Per-process timeline for Chrome trace export
+ *
+ * Every send and receive, FSM state change and critical section
+ * entry and exit is a TIMELINE_SLOT record with Lamport time of the
+ * lab and CLOCK_MONOTONIC time, which is one clock for all processes
+ * of the host. Records go to a ring in process memory, the way
+ * binlog.c does it, and the ring goes to timeline.<id>.bin with one
+ * write() once half full and at exit.
+ *
+ * A frame is numbered by its channel: seq is the count of frames
+ * that went from self to peer before it, or came from peer to self.
+ * Channels deliver in order, so send n of a to b and receive n of b
+ * from a are the same frame, and the wire stays as it is. Tree
+ * multicast is numbered per hop; origin keeps the sender the lab
+ * sees. timeline_export links the pairs with flow events.
+ */
+
+typedef struct {
+    TimelineRecord * records;
+    size_t len;
+    int fd;
+    node_id self;     ///< process the ring is filled by
+    pid_t owner;      ///< same for flush, ring inherited through fork belongs to the parent
+    uint32_t * sent;  ///< frames sent per peer
+    uint32_t * received;
+    int state;        ///< last FSM state, repeated states aren't recorded
+} Timeline;
+
+static Timeline timeline = {NULL, 0, -1, -1, 0, NULL, NULL, -1};
+
+static uint64_t timeline_wall(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void timeline_atexit(void)
+{
+    (void)timeline_flush();
+}
+
+/**
+ * Start the timeline of this process, records and descriptor
+ * inherited through fork stay with the parent
+ */
+static int timeline_open(TaskStruct * task)
+{
+    if (timeline.records == NULL) {
+        timeline.records = malloc(sizeof(TimelineRecord) * TIMELINE_RING);
+        if (timeline.records == NULL || RC_FAIL(atexit(timeline_atexit))) {
+            return -1;
+        }
+    }
+    if (timeline.fd >= 0) {
+        close(timeline.fd);
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), TIMELINE_FILE_FMT, task->local_pid);
+    timeline.fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, MODE);
+    free(timeline.sent);
+    free(timeline.received);
+    timeline.sent = calloc(task->total_proc, sizeof(uint32_t));
+    timeline.received = calloc(task->total_proc, sizeof(uint32_t));
+    if (timeline.fd < 0 || timeline.sent == NULL || timeline.received == NULL) {
+        perror("timeline_open error");
+        return -1;
+    }
+
+    timeline.len = 0;
+    timeline.self = task->local_pid;
+    timeline.owner = getpid();
+    timeline.state = -1;
+    return 0;
+}
+
+int timeline_flush(void)
+{
+    if (timeline.len == 0 || timeline.owner != getpid()) {
+        return 0;
+    }
+
+    size_t len = sizeof(TimelineRecord) * timeline.len;
+    const char * buf = (const char *)timeline.records;
+    while (len > 0) {
+        ssize_t written = write(timeline.fd, buf, len);
+        if (written < 0) {
+            perror("timeline_flush write error");
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    timeline.len = 0;
+    return 0;
+}
+
+/**
+ * @return record to fill, followed by extra slots, NULL on error
+ */
+static TimelineRecord * timeline_append(TaskStruct * task, TimelineKind kind, int extra)
+{
+    // ids are unique, so a new id is a new process without a syscall
+    if (timeline.self != task->local_pid && RC_FAIL(timeline_open(task))) {
+        return NULL;
+    }
+    if (timeline.len + 1 + extra > TIMELINE_RING && RC_FAIL(timeline_flush())) {
+        return NULL;
+    }
+
+    TimelineRecord * rec = &timeline.records[timeline.len];
+    timeline.len += 1 + extra;
+    memset(rec, 0, sizeof(TimelineRecord));
+    rec->magic = TIMELINE_MAGIC;
+    rec->kind = kind;
+    rec->extra = extra;
+    rec->self = task->local_pid;
+    rec->peer = task->local_pid;
+    rec->origin = task->local_pid;
+    rec->wall = timeline_wall();
+    return rec;
+}
+
+/**
+ * @return 0 on success, -1 on error
+ */
+static int timeline_commit(void)
+{
+    return (timeline.len >= TIMELINE_RING / 2) ? timeline_flush() : 0;
+}
+
+int timeline_message(TaskStruct * task, node_id hop, node_id peer, const Message * msg, int direction)
+{
+    TimelineRecord * rec = timeline_append(task, (direction == OUTCOMING) ? TIMELINE_SEND : TIMELINE_RECEIVE, 0);
+    if (rec == NULL) {
+        return -1;
+    }
+    rec->peer = hop;
+    rec->origin = peer;
+    rec->type = msg->s_header.s_type;
+    rec->seq = (direction == OUTCOMING) ? timeline.sent[hop]++ : timeline.received[hop]++;
+    rec->time = ext_time(msg);
+    return timeline_commit();
+}
+
+int timeline_state(TaskStruct * task, int state, const char * name, timestamp_ext_t time)
+{
+    if (timeline.self == task->local_pid && timeline.state == state) {
+        return 0;
+    }
+
+    TimelineRecord * rec = timeline_append(task, TIMELINE_STATE, 1);
+    if (rec == NULL) {
+        return -1;
+    }
+    timeline.state = state;
+    rec->type = state;
+    rec->time = time;
+
+    char * slot = (char *)(rec + 1);
+    memset(slot, 0, TIMELINE_SLOT);
+    strncpy(slot, name, TIMELINE_SLOT - 1);
+    return timeline_commit();
+}
+
+int timeline_mark(TaskStruct * task, TimelineKind kind, timestamp_ext_t time)
+{
+    TimelineRecord * rec = timeline_append(task, kind, 0);
+    if (rec == NULL) {
+        return -1;
+    }
+    rec->time = time;
+    return timeline_commit();
+}
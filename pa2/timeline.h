@@ -0,0 +1,48 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+
+#include <stdint.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "proc.h"
+
+/// Timeline of process id, timeline_export makes a Chrome trace of them
+#define TIMELINE_FILE_FMT "timeline.%d.bin"
+
+#define TIMELINE_MAGIC 0x71E1
+
+enum {
+    TIMELINE_SLOT = 32,  ///< record size, state name goes in a slot of it
+    TIMELINE_RING = 4096 ///< records kept in memory before a flush
+};
+
+typedef enum {
+    TIMELINE_SEND = 0,
+    TIMELINE_RECEIVE,
+    TIMELINE_STATE,    ///< FSM entered a state, its name follows in a slot
+    TIMELINE_CS_ENTER,
+    TIMELINE_CS_EXIT
+} TimelineKind;
+
+typedef struct {
+    uint16_t magic;
+    uint8_t kind;
+    uint8_t extra;        ///< slots of text following the record
+    node_id self;
+    node_id peer;         ///< process the frame went to or came from
+    node_id origin;       ///< sender the lab sees, differs from peer for tree multicast
+    int16_t type;         ///< message type or FSM state
+    uint32_t seq;         ///< number of the frame on channel self-peer in its direction
+    timestamp_ext_t time; ///< Lamport time, physical time in pa2
+    uint64_t wall;        ///< CLOCK_MONOTONIC, ns
+} TimelineRecord;
+
+int timeline_message(TaskStruct * task, node_id hop, node_id peer, const Message * msg, int direction);
+
+int timeline_state(TaskStruct * task, int state, const char * name, timestamp_ext_t time);
+
+int timeline_mark(TaskStruct * task, TimelineKind kind, timestamp_ext_t time);
+
+int timeline_flush(void);
+#endif
@@ -0,0 +1,24 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+
+#include "ipc.h"
+#include "proc.h"
+
+int uring_init(TaskStruct * task);
+
+int uring_send(TaskStruct * task, node_id dst, const Message * msg);
+
+int uring_log(TaskStruct * task, const char * buf, size_t len);
+
+void uring_arm(TaskStruct * task);
+
+int uring_commit(TaskStruct * task);
+
+int uring_poll(TaskStruct * task);
+
+node_id uring_wait_frame(TaskStruct * task);
+
+int uring_flush(TaskStruct * task);
+#endif
@@ -0,0 +1,377 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "banking.h"
+#include "workload.h"
+
+/* Banking workload for the manager, -W in place of bank_robbery
+ *
+ *    -W count=10000,seed=1,pairs=zipf:1.2,amount=uniform:10,burst=100,gap=500
+ *
+ * - count   transfers in total
+ * - seed    of the generator, same seed gives the same transfers
+ * - pairs   uniform, or zipf:s with department k drawn with weight
+ *           1 / k^s, for both ends of a transfer
+ * - amount  fixed:A, uniform:A from 1 to A, or geometric:A with mean A
+ * - burst   transfers issued at once, the next burst goes once the
+ *           previous one is acknowledged; all of them by default
+ * - gap     microseconds to wait before each next burst
+ *
+ * The manager keeps a single transfer in flight, so transfer k is
+ * sent when it's issued or when transfer k - 1 is acknowledged,
+ * whichever is later. The report has ACK latency from that send,
+ * completion from the issue, which adds the wait in the queue, and
+ * the time of the whole run up to the last ACK and to the histories.
+ *
+ * Histories keep MAX_T ticks, a long workload outruns them and the
+ * states past that aren't recorded. Every department stamps its
+ * history with the time of its last state, the report counts those
+ * cut short and the lab exits with failure then.
+ *
+ * The manager keeps the balances the transfers issued so far leave,
+ * so a source never pays more than it has: an empty one is drawn
+ * again, an amount above its balance is cut down to it, and the
+ * report counts the cut transfers.
+ */
+
+enum {
+    PAIRS_UNIFORM = 0,
+    PAIRS_ZIPF
+};
+
+enum {
+    AMOUNT_FIXED = 0,
+    AMOUNT_UNIFORM,
+    AMOUNT_GEOMETRIC
+};
+
+struct Workload {
+    int count;
+    uint64_t seed;
+    uint64_t state; ///< xorshift64* of the seed
+    int pairs;
+    double skew;
+    double * cdf;   ///< of departments for zipf pairs
+    int amount_kind;
+    int amount;
+    int burst;
+    int gap_us;
+
+    balance_t * balances; ///< of departments 1..N once the issued transfers are done
+    int cut;              ///< transfers cut down to the balance of the source
+    int truncated;        ///< histories that outgrew MAX_T
+
+    int issued;
+    int acked;
+    long long * issue; ///< CLOCK_MONOTONIC ns of every transfer
+    long long * ack;
+    long long histories;
+};
+
+static long long workload_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double workload_random(Workload * w)
+{
+    w->state ^= w->state >> 12;
+    w->state ^= w->state << 25;
+    w->state ^= w->state >> 27;
+    return ((w->state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+static local_id pick_department(Workload * w, int departments)
+{
+    double u = workload_random(w);
+    if (w->pairs == PAIRS_UNIFORM) {
+        return 1 + (local_id)(u * departments);
+    }
+    int low = 0;
+    int high = departments - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (w->cdf[mid] < u) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return 1 + low;
+}
+
+static balance_t pick_amount(Workload * w)
+{
+    switch (w->amount_kind) {
+    case AMOUNT_UNIFORM:
+        return 1 + (balance_t)(workload_random(w) * w->amount);
+    case AMOUNT_GEOMETRIC: {
+        // trials until the first success with p = 1 / amount
+        balance_t amount = 1;
+        while (amount < INT16_MAX && workload_random(w) * w->amount >= 1) {
+            amount++;
+        }
+        return amount;
+    }
+    default:
+        return w->amount;
+    }
+}
+
+static int parse_amount(Workload * w, const char * value)
+{
+    static const char * kinds[] = {"fixed:", "uniform:", "geometric:"};
+    for (int kind = AMOUNT_FIXED; kind <= AMOUNT_GEOMETRIC; kind++) {
+        size_t len = strlen(kinds[kind]);
+        if (strncmp(value, kinds[kind], len) == 0) {
+            w->amount_kind = kind;
+            w->amount = atoi(value + len);
+            return (w->amount > 0 && w->amount <= INT16_MAX) ? 0 : -1;
+        }
+    }
+    return -1;
+}
+
+Workload * workload_parse(const char * spec)
+{
+    Workload * w = calloc(1, sizeof(Workload));
+    char * copy = strdup(spec);
+    if (w == NULL || copy == NULL) {
+        perror("workload_parse error");
+        return NULL;
+    }
+    w->count = 1000;
+    w->seed = 1;
+    w->amount = 1;
+
+    int rc = 0;
+    for (char * item = strtok(copy, ","); item != NULL && RC_OK(rc); item = strtok(NULL, ",")) {
+        char * value = strchr(item, '=');
+        if (value == NULL) {
+            rc = -1;
+            break;
+        }
+        *value++ = '\0';
+        if (strcmp(item, "count") == 0) {
+            w->count = atoi(value);
+            rc = (w->count > 0) ? 0 : -1;
+        }
+        else if (strcmp(item, "seed") == 0) {
+            w->seed = strtoull(value, NULL, 10);
+        }
+        else if (strcmp(item, "pairs") == 0 && strcmp(value, "uniform") == 0) {
+            w->pairs = PAIRS_UNIFORM;
+        }
+        else if (strcmp(item, "pairs") == 0 && strncmp(value, "zipf:", 5) == 0) {
+            w->pairs = PAIRS_ZIPF;
+            w->skew = atof(value + 5);
+            rc = (w->skew >= 0) ? 0 : -1;
+        }
+        else if (strcmp(item, "amount") == 0) {
+            rc = parse_amount(w, value);
+        }
+        else if (strcmp(item, "burst") == 0) {
+            w->burst = atoi(value);
+            rc = (w->burst > 0) ? 0 : -1;
+        }
+        else if (strcmp(item, "gap") == 0) {
+            w->gap_us = atoi(value);
+            rc = (w->gap_us >= 0) ? 0 : -1;
+        }
+        else {
+            rc = -1;
+        }
+    }
+    free(copy);
+    if (RC_FAIL(rc)) {
+        fprintf(stderr, "Bad workload %s\n", spec);
+        free(w);
+        return NULL;
+    }
+
+    w->burst = (w->burst == 0 || w->burst > w->count) ? w->count : w->burst;
+    // xorshift never leaves zero
+    w->state = w->seed ? w->seed : 0x9E3779B97F4A7C15ULL;
+    w->issue = malloc(sizeof(long long) * w->count);
+    w->ack = malloc(sizeof(long long) * w->count);
+    if (w->issue == NULL || w->ack == NULL) {
+        perror("workload_parse error");
+        return NULL;
+    }
+    return w;
+}
+
+static int issue_burst(TaskStruct * task)
+{
+    Workload * w = task->workload;
+    int departments = task->total_proc - 1;
+    int n = 0;
+    for (; n < w->burst && w->issued < w->count; n++) {
+        local_id src;
+        do {
+            src = pick_department(w, departments);
+        } while (w->balances[src - 1] == 0);
+        local_id dst;
+        do {
+            dst = pick_department(w, departments);
+        } while (dst == src);
+        balance_t amount = pick_amount(w);
+        if (amount > w->balances[src - 1]) {
+            amount = w->balances[src - 1];
+            w->cut++;
+        }
+        w->balances[src - 1] -= amount;
+        w->balances[dst - 1] += amount;
+
+        w->issue[w->issued++] = workload_now();
+        transfer(task, src, dst, amount);
+    }
+    return n;
+}
+
+int workload_balances(Workload * w, char ** balances, int departments)
+{
+    if ((w->balances = malloc(sizeof(balance_t) * departments)) == NULL) {
+        perror("workload_balances error");
+        return -1;
+    }
+    long total = 0;
+    for (int i = 0; i < departments; i++) {
+        w->balances[i] = atoi(balances[i]);
+        total += w->balances[i];
+    }
+    if (total <= 0) {
+        fprintf(stderr, "Workload needs money to move\n");
+        return -1;
+    }
+    return 0;
+}
+
+int workload_start(TaskStruct * task)
+{
+    Workload * w = task->workload;
+    int departments = task->total_proc - 1;
+    if (departments < 2) {
+        fprintf(stderr, "Workload needs 2 departments at least\n");
+        return -1;
+    }
+
+    if (w->pairs == PAIRS_ZIPF) {
+        if ((w->cdf = malloc(sizeof(double) * departments)) == NULL) {
+            perror("workload_start error");
+            return -1;
+        }
+        double sum = 0;
+        for (int rank = 1; rank <= departments; rank++) {
+            sum += pow(rank, -w->skew);
+            w->cdf[rank - 1] = sum;
+        }
+        for (int i = 0; i < departments; i++) {
+            w->cdf[i] /= sum;
+        }
+    }
+
+    (void)issue_burst(task);
+    return 0;
+}
+
+void workload_ack(TaskStruct * task)
+{
+    Workload * w = task->workload;
+    if (w->acked < w->issued) {
+        w->ack[w->acked++] = workload_now();
+    }
+}
+
+void workload_history(TaskStruct * task, timestamp_ext_t time)
+{
+    // s_history_len is 8-bit, states at MAX_T and later are dropped
+    if (time < 0 || time >= MAX_T) {
+        task->workload->truncated++;
+    }
+}
+
+int workload_next(TaskStruct * task)
+{
+    Workload * w = task->workload;
+    if (w->issued == w->count) {
+        return 0;
+    }
+    if (w->gap_us > 0) {
+        struct timespec delay = {w->gap_us / 1000000, (w->gap_us % 1000000) * 1000L};
+        nanosleep(&delay, NULL);
+    }
+    return issue_burst(task);
+}
+
+static int compare_ns(const void * a, const void * b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_latency(FILE * out, const char * name, long long * samples, int count)
+{
+    qsort(samples, count, sizeof(long long), compare_ns);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    fprintf(out, "%-14s mean %.1f p50 %.1f p99 %.1f max %.1f\n", name,
+            sum / count / 1e3, samples[count / 2] / 1e3, samples[(int)(count * 0.99)] / 1e3, samples[count - 1] / 1e3);
+}
+
+int workload_finish(TaskStruct * task)
+{
+    Workload * w = task->workload;
+    w->histories = workload_now();
+
+    FILE * out = fopen(WORKLOAD_FILE, "w");
+    long long * samples = malloc(sizeof(long long) * w->count);
+    if (out == NULL || samples == NULL || w->acked == 0) {
+        perror("workload_finish error");
+        return -1;
+    }
+
+    long long start = w->issue[0];
+    long long last = w->ack[w->acked - 1];
+    fprintf(out, "# banking workload, latency in us\n");
+    fprintf(out, "%-14s %d\n", "departments", task->total_proc - 1);
+    fprintf(out, "%-14s %d of %d\n", "transfers", w->acked, w->count);
+    fprintf(out, "%-14s %d\n", "cut_to_balance", w->cut);
+    fprintf(out, "%-14s %d of %d\n", "truncated", w->truncated, task->total_proc - 1);
+    fprintf(out, "%-14s %llu\n", "seed", (unsigned long long)w->seed);
+    fprintf(out, "%-14s %.3f ms\n", "last_ack", (last - start) / 1e6);
+    fprintf(out, "%-14s %.3f ms\n", "histories", (w->histories - start) / 1e6);
+    fprintf(out, "%-14s %.0f\n", "transfers/s", w->acked / ((last - start) / 1e9));
+
+    for (int i = 0; i < w->acked; i++) {
+        long long sent = (i > 0 && w->ack[i - 1] > w->issue[i]) ? w->ack[i - 1] : w->issue[i];
+        samples[i] = w->ack[i] - sent;
+    }
+    print_latency(out, "ack", samples, w->acked);
+    for (int i = 0; i < w->acked; i++) {
+        samples[i] = w->ack[i] - w->issue[i];
+    }
+    print_latency(out, "completion", samples, w->acked);
+
+    free(samples);
+    if (fclose(out) != 0) {
+        return -1;
+    }
+    if (w->truncated > 0) {
+        fprintf(stderr, "%d histories outgrew MAX_T = %d, print_history shows them cut short\n", w->truncated, MAX_T);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "proc.h"
+
+/* Binary pipe log
+ *
+ * Text pipe log costs a sprintf and a write() per message. Binary
+ * log appends a fixed BINLOG_SLOT record per message to a ring in
+ * process memory instead:
+ *
+ *    +-------+-----+------+------+------+-------------+------+--------+
+ *    | magic | dir | extra| self | peer | type, len   | time | detail |
+ *    +-------+-----+------+------+------+-------------+------+--------+
+ *
+ * STARTED and DONE carry their text, which follows the record in
+ * extra slots. These are two messages per process, the hot path
+ * stays a copy of 32 bytes.
+ *
+ * The ring is written with one write() once it is half full, on
+ * send_flush and at exit, so the log costs a syscall per
+ * BINLOG_RING / 2 messages. The process is single threaded and the
+ * ring is its own, so there is nothing to lock. O_APPEND keeps
+ * chunks of different processes whole, and every record names its
+ * process. binlog_decode turns the file into pipes.log text.
+ */
+
+typedef struct {
+    BinlogRecord * records;
+    size_t len;
+    int fd;
+    node_id self; ///< process the ring is filled by
+    pid_t owner;  ///< same for flush, ring inherited through fork belongs to the parent
+} Binlog;
+
+static Binlog binlog = {NULL, 0, -1, -1, 0};
+
+static void binlog_atexit(void)
+{
+    (void)binlog_flush();
+}
+
+/**
+ * Start the ring of this process, dropping records inherited through fork
+ */
+static int binlog_open(int fd, node_id self)
+{
+    if (binlog.records == NULL) {
+        binlog.records = malloc(sizeof(BinlogRecord) * BINLOG_RING);
+        if (binlog.records == NULL || RC_FAIL(atexit(binlog_atexit))) {
+            return -1;
+        }
+    }
+    binlog.len = 0;
+    binlog.fd = fd;
+    binlog.self = self;
+    binlog.owner = getpid();
+    return 0;
+}
+
+int binlog_flush(void)
+{
+    if (binlog.len == 0 || binlog.owner != getpid()) {
+        return 0;
+    }
+
+    size_t len = sizeof(BinlogRecord) * binlog.len;
+    const char * buf = (const char *)binlog.records;
+    while (len > 0) {
+        ssize_t written = write(binlog.fd, buf, len);
+        if (written < 0) {
+            perror("binlog_flush write error");
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    binlog.len = 0;
+    return 0;
+}
+
+int binlog_append(int fd, node_id self, node_id peer, const Message * msg, int direction)
+{
+    // ids are unique, so a new id is a new process without a syscall
+    if (binlog.self != self && RC_FAIL(binlog_open(fd, self))) {
+        return -1;
+    }
+
+    uint16_t len = ext_payload_len(msg);
+    int text = msg->s_header.s_type == STARTED || msg->s_header.s_type == DONE;
+    int extra = text ? (len + BINLOG_SLOT - 1) / BINLOG_SLOT : 0;
+    if (binlog.len + 1 + extra > BINLOG_RING && RC_FAIL(binlog_flush())) {
+        return -1;
+    }
+
+    BinlogRecord * rec = &binlog.records[binlog.len++];
+    rec->magic = BINLOG_MAGIC;
+    rec->direction = direction;
+    rec->extra = extra;
+    rec->self = self;
+    rec->peer = peer;
+    rec->type = msg->s_header.s_type;
+    rec->payload_len = len;
+    rec->reserved = 0;
+    rec->time = ext_time(msg);
+    memset(rec->detail, 0, sizeof(rec->detail));
+    memcpy(rec->detail, msg->s_payload, (len < sizeof(rec->detail)) ? len : sizeof(rec->detail));
+
+    if (extra > 0) {
+        char * slots = (char *)&binlog.records[binlog.len];
+        memset(slots + len, 0, extra * BINLOG_SLOT - len);
+        memcpy(slots, msg->s_payload, len);
+        binlog.len += extra;
+    }
+
+    return (binlog.len >= BINLOG_RING / 2) ? binlog_flush() : 0;
+}
@@ -0,0 +1,35 @@
+#ifndef BINLOG_H_
+#define BINLOG_H_
+
+#include <stdint.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+
+/// Binary log written instead of pipes.log
+#define BINLOG_FILE "pipes.bin"
+
+#define BINLOG_MAGIC 0xB10C
+
+enum {
+    BINLOG_SLOT = 32,    ///< record size, payload text goes in slots of it
+    BINLOG_RING = 4096   ///< records kept in memory before a flush
+};
+
+typedef struct {
+    uint16_t magic;
+    uint8_t direction;    ///< INCOMING or OUTCOMING
+    uint8_t extra;        ///< slots of payload text following the record
+    node_id self;
+    node_id peer;
+    int16_t type;
+    uint16_t payload_len;
+    uint32_t reserved;
+    timestamp_ext_t time; ///< Lamport time of the message
+    char detail[8];       ///< head of the payload, enough for TRANSFER and BALANCE_HISTORY
+} BinlogRecord;
+
+int binlog_append(int fd, node_id self, node_id peer, const Message * msg, int direction);
+
+int binlog_flush(void);
+#endif
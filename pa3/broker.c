@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// send() of libc would clash with send() of ipc.h, only sendmsg is used here
+#define send libc_send
+#include <sys/socket.h>
+#undef send
+
+#include "broker.h"
+#include "pipes.h"
+
+/* Lazy pipe mesh
+ *
+ * Only channels between the parent and its children are created
+ * before fork. Every child also gets a control socket to the parent.
+ *
+ * First send to a peer without a channel asks the parent for one:
+ *
+ *    child A              parent               child B
+ *       | -- connect B -->   |                    |
+ *       |                 pipe2() x 2             |
+ *       | <-- ends of A --   | -- ends of B ----> |
+ *
+ * Parent passes both ends of the new channel to each side with
+ * SCM_RIGHTS and closes its copies. Request of B for A made in the
+ * meantime finds the channel brokered already and is dropped.
+ * A waits for its ends right away, B installs them whenever it
+ * meets the control socket in its readiness set.
+ *
+ * Descriptors and startup work scale with edges actually used
+ * instead of N * (N - 1).
+ */
+
+typedef struct {
+    node_id peer;
+} BrokerMessage;
+
+int broker_init(TaskStruct * task)
+{
+    int n = task->total_proc;
+    task->brokers = (int(*)[2])malloc(sizeof(int) * 2 * n);
+    task->brokered = calloc(n * n, 1);
+    for (node_id i = 1; i < n; i++) {
+        if (RC_FAIL(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, task->brokers[i]))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int broker_attach(TaskStruct * task)
+{
+    for (node_id i = 1; i < task->total_proc; i++) {
+        // parent keeps [0] of every child, child keeps only its own [1]
+        int keep = (task->local_pid == PARENT_ID) ? 0 : (i == task->local_pid) ? 1 : -1;
+        for (int end = 0; end < 2; end++) {
+            if (end != keep && close(task->brokers[i][end])) {
+                perror("broker_attach close error");
+                return -1;
+            }
+        }
+        if (keep < 0) {
+            continue;
+        }
+
+        struct epoll_event event = {0};
+        event.events = EPOLLIN;
+        event.data.u32 = ((task->local_pid == PARENT_ID) ? i : PARENT_ID) | POLL_BROKER;
+        if (RC_FAIL(epoll_ctl(task->epoll_fd, EPOLL_CTL_ADD, task->brokers[i][keep], &event))) {
+            perror("broker_attach epoll_ctl error");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int broker_fd(TaskStruct * task, node_id peer)
+{
+    return (task->local_pid == PARENT_ID) ? task->brokers[peer][0] : task->brokers[task->local_pid][1];
+}
+
+/**
+ * Hand ends of a new channel with given peer over to a child
+ */
+static int broker_push(TaskStruct * task, node_id to, node_id peer, int rfd, int wfd)
+{
+    BrokerMessage msg = {peer};
+    int fds[2] = {rfd, wfd};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov = {&msg, sizeof(msg)};
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // child may be gone already, that's not our failure
+    return (sendmsg(broker_fd(task, to), &hdr, MSG_NOSIGNAL) < 0 && errno != EPIPE) ? -1 : 0;
+}
+
+/**
+ * Parent side: set up channel asked for by given child
+ */
+static int broker_serve(TaskStruct * task, node_id child)
+{
+    BrokerMessage msg;
+    ssize_t len = recv(broker_fd(task, child), &msg, sizeof(msg), MSG_DONTWAIT);
+    if (len <= 0) {
+        if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+            return 0;
+        }
+        // child has exited
+        epoll_ctl(task->epoll_fd, EPOLL_CTL_DEL, broker_fd(task, child), NULL);
+        return 0;
+    }
+
+    int n = task->total_proc;
+    node_id peer = msg.peer;
+    if (peer <= PARENT_ID || peer >= n || peer == child || task->brokered[child * n + peer]) {
+        return 0;
+    }
+    task->brokered[child * n + peer] = task->brokered[peer * n + child] = 1;
+
+    int to_peer[2];
+    int to_child[2];
+    if (RC_FAIL(pipe2(to_peer, O_NONBLOCK)) || RC_FAIL(pipe2(to_child, O_NONBLOCK))) {
+        perror("broker_serve pipe2 error");
+        return -1;
+    }
+
+    int rc = 0;
+    if (RC_FAIL(broker_push(task, child, peer, to_child[0], to_peer[1])) ||
+        RC_FAIL(broker_push(task, peer, child, to_peer[0], to_child[1]))) {
+        perror("broker_serve sendmsg error");
+        rc = -1;
+    }
+    close(to_peer[0]);
+    close(to_peer[1]);
+    close(to_child[0]);
+    close(to_child[1]);
+    return rc;
+}
+
+/**
+ * Child side: install channel ends passed by the parent
+ *
+ * @return 1 if a channel was installed, 0 if there was nothing to take,
+ *         -1 if the parent is gone or on error
+ */
+static int broker_accept(TaskStruct * task, int flags)
+{
+    BrokerMessage msg;
+    int fds[2];
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct iovec iov = {&msg, sizeof(msg)};
+    struct msghdr hdr = {0};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t len = recvmsg(broker_fd(task, PARENT_ID), &hdr, flags);
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return 0;
+    }
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr);
+    if (len != sizeof(msg) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    task->channels[msg.peer].rd = fds[0];
+    task->channels[msg.peer].wr = fds[1];
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN;
+    event.data.u32 = msg.peer;
+    if (RC_FAIL(epoll_ctl(task->epoll_fd, EPOLL_CTL_ADD, fds[0], &event))) {
+        perror("broker_accept epoll_ctl error");
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * Ask the parent for a channel to given peer and wait until it's there
+ */
+int broker_connect(TaskStruct * task, node_id peer)
+{
+    BrokerMessage msg = {peer};
+    if (write(broker_fd(task, PARENT_ID), &msg, sizeof(msg)) < 0) {
+        perror("broker_connect write error");
+        return -1;
+    }
+
+    // channels pushed for other peers meanwhile are installed as well
+    while (get_recipient(task, peer) < 0) {
+        if (broker_accept(task, 0) < 0) {
+            fprintf(stderr, "process %d: no channel to %d from the parent\n", task->local_pid, peer);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Install every channel already pushed by the parent, doesn't block
+ */
+int broker_poll(TaskStruct * task)
+{
+    int rc;
+    while ((rc = broker_accept(task, MSG_DONTWAIT)) > 0) {
+    }
+    return (rc < 0) ? -1 : 0;
+}
+
+/**
+ * Control socket of given peer is readable
+ */
+int broker_handle(TaskStruct * task, node_id peer)
+{
+    if (task->local_pid == PARENT_ID) {
+        return broker_serve(task, peer);
+    }
+    if (broker_accept(task, MSG_DONTWAIT) < 0) {
+        // parent has exited, nothing will come from here anymore
+        epoll_ctl(task->epoll_fd, EPOLL_CTL_DEL, broker_fd(task, PARENT_ID), NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef BROKER_H_
+#define BROKER_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+/* Control socket in the readiness set, flagged to tell it from channels */
+#define POLL_BROKER 0x20000
+
+int broker_init(TaskStruct * task);
+
+int broker_attach(TaskStruct * task);
+
+int broker_connect(TaskStruct * task, node_id peer);
+
+int broker_poll(TaskStruct * task);
+
+int broker_handle(TaskStruct * task, node_id peer);
+#endif
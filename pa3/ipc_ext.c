@@ -0,0 +1,36 @@
+#include <string.h>
+
+#include "ipc_ext.h"
+
+int ext_wrap(const Message * msg, timestamp_ext_t time, Message * out)
+{
+    size_t len = msg->s_header.s_payload_len;
+    if (len > MAX_EXT_PAYLOAD_LEN) {
+        return -1;
+    }
+
+    ExtTrailer trailer = {time};
+    memmove(out, msg, sizeof(MessageHeader) + len);
+    memcpy(out->s_payload + len, &trailer, sizeof(trailer));
+    out->s_header.s_magic = EXT_MESSAGE_MAGIC;
+    out->s_header.s_payload_len = len + sizeof(trailer);
+    out->s_header.s_local_time = (timestamp_t)time;
+    return 0;
+}
+
+timestamp_ext_t ext_time(const Message * msg)
+{
+    if (msg->s_header.s_magic != EXT_MESSAGE_MAGIC) {
+        return msg->s_header.s_local_time;
+    }
+
+    ExtTrailer trailer;
+    memcpy(&trailer, msg->s_payload + ext_payload_len(msg), sizeof(trailer));
+    return trailer.s_time;
+}
+
+uint16_t ext_payload_len(const Message * msg)
+{
+    uint16_t len = msg->s_header.s_payload_len;
+    return (msg->s_header.s_magic == EXT_MESSAGE_MAGIC) ? len - sizeof(ExtTrailer) : len;
+}
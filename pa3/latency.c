@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency.h"
+
+/* Send to receive latency per message type
+ *
+ * send stamps a copy of the message with CLOCK_MONOTONIC time in a
+ * trailer, the way ext_wrap appends its own:
+ *
+ *    +-------------------------------+---------+----------------+
+ *    | MessageHeader                 | payload | LatencyTrailer |
+ *    | (magic = LATENCY_MAGIC,       |         | (sent, magic)  |
+ *    |  s_payload_len covers trailer)|         |                |
+ *    +-------------------------------+---------+----------------+
+ *
+ * receive strips the trailer before anybody looks at the message,
+ * so labs, logs and ext_time see it as it was sent. Stamping wraps
+ * whatever the lab sent, ext messages included, and goes under tree
+ * and slab wrapping, so a multicast is timed from the original send
+ * to every receiver.
+ *
+ * Latency goes to a log-linear histogram of the receiver, HDR style:
+ * LATENCY_SUB buckets per power of two, so a bucket is within 3% of
+ * the values in it, and recording is a clz and an increment.
+ * Histograms of all processes live in one shared mapping made
+ * before fork, so the parent merges them at exit into LATENCY_FILE
+ * without any files of the children.
+ */
+
+typedef struct {
+    LatencyHistogram * base;
+    node_id nodes;
+    pid_t owner; ///< process that dumps at exit, children inherit the handler
+} Latency;
+
+static Latency latency = {NULL, 0, 0};
+
+static const char * type_names[LATENCY_TYPES] = {
+    "STARTED", "DONE", "ACK", "STOP", "TRANSFER",
+    "BALANCE_HISTORY", "CS_REQUEST", "CS_REPLY", "CS_RELEASE"
+};
+
+static uint64_t latency_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int latency_bucket(uint64_t ns)
+{
+    if (ns < LATENCY_SUB) {
+        return ns;
+    }
+    int exp = 63 - __builtin_clzll(ns);
+    if (exp > LATENCY_MAX_EXP) {
+        return LATENCY_BUCKETS - 1;
+    }
+    return (exp - LATENCY_SUB_BITS + 1) * LATENCY_SUB + ((ns >> (exp - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+/**
+ * @return middle of the values falling into the bucket
+ */
+static double latency_value(int bucket)
+{
+    if (bucket < LATENCY_SUB) {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_SUB - 1;
+    uint64_t low = (uint64_t)(LATENCY_SUB + bucket % LATENCY_SUB) << shift;
+    return low + ((1ULL << shift) - 1) / 2.0;
+}
+
+static double latency_percentile(const LatencyHistogram * hist, double q)
+{
+    uint64_t rank = (uint64_t)(q * hist->count + 0.5);
+    rank = (rank == 0) ? 1 : rank;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen >= rank) {
+            double value = latency_value(bucket);
+            return (value > hist->max) ? hist->max : value;
+        }
+    }
+    return hist->max;
+}
+
+static void latency_print(FILE * out, const char * type, const char * node, const LatencyHistogram * hist)
+{
+    fprintf(out, "%-16s %5s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+            type, node, (unsigned long long)hist->count,
+            latency_percentile(hist, 0.5) / 1e3, latency_percentile(hist, 0.99) / 1e3,
+            latency_percentile(hist, 0.999) / 1e3, hist->max / 1e3);
+}
+
+static void latency_dump(void)
+{
+    if (latency.owner != getpid()) {
+        return;
+    }
+    FILE * out = fopen(LATENCY_FILE, "w");
+    LatencyHistogram * all = malloc(sizeof(LatencyHistogram));
+    if (out == NULL || all == NULL) {
+        perror("latency_dump error");
+        return;
+    }
+
+    fprintf(out, "# send to receive latency, us\n");
+    fprintf(out, "%-16s %5s %10s %10s %10s %10s %10s\n", "type", "node", "count", "p50", "p99", "p99.9", "max");
+    for (int type = 0; type < LATENCY_TYPES; type++) {
+        memset(all, 0, sizeof(LatencyHistogram));
+        for (node_id id = 0; id < latency.nodes; id++) {
+            const LatencyHistogram * hist = &latency.base[id * LATENCY_TYPES + type];
+            all->count += hist->count;
+            all->max = (hist->max > all->max) ? hist->max : all->max;
+            for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+                all->buckets[bucket] += hist->buckets[bucket];
+            }
+        }
+        if (all->count == 0) {
+            continue;
+        }
+
+        latency_print(out, type_names[type], "all", all);
+        for (node_id id = 0; id < latency.nodes; id++) {
+            const LatencyHistogram * hist = &latency.base[id * LATENCY_TYPES + type];
+            if (hist->count > 0) {
+                char node[8];
+                snprintf(node, sizeof(node), "%d", id);
+                latency_print(out, type_names[type], node, hist);
+            }
+        }
+    }
+    free(all);
+    fclose(out);
+}
+
+int latency_init(TaskStruct * task)
+{
+    size_t size = sizeof(LatencyHistogram) * LATENCY_TYPES * task->total_proc;
+    void * base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("latency_init mmap error");
+        return -1;
+    }
+    if (latency.base == NULL && RC_FAIL(atexit(latency_dump))) {
+        return -1;
+    }
+
+    latency.base = base;
+    latency.nodes = task->total_proc;
+    latency.owner = getpid();
+    task->latency = base;
+    task->latency_size = size;
+    return 0;
+}
+
+const Message * latency_stamp(const Message * msg, Message * out)
+{
+    size_t len = msg->s_header.s_payload_len;
+    if (len + sizeof(LatencyTrailer) > MAX_PAYLOAD_LEN) {
+        return msg;
+    }
+
+    LatencyTrailer trailer = {latency_now(), msg->s_header.s_magic};
+    memcpy(out, msg, sizeof(MessageHeader) + len);
+    memcpy(out->s_payload + len, &trailer, sizeof(trailer));
+    out->s_header.s_magic = LATENCY_MAGIC;
+    out->s_header.s_payload_len = len + sizeof(trailer);
+    return out;
+}
+
+void latency_record(TaskStruct * task, Message * msg)
+{
+    if (msg->s_header.s_magic != LATENCY_MAGIC) {
+        return;
+    }
+
+    LatencyTrailer trailer;
+    uint16_t len = msg->s_header.s_payload_len - sizeof(trailer);
+    memcpy(&trailer, msg->s_payload + len, sizeof(trailer));
+    msg->s_header.s_magic = trailer.s_magic;
+    msg->s_header.s_payload_len = len;
+
+    uint16_t type = msg->s_header.s_type;
+    if (type >= LATENCY_TYPES) {
+        return;
+    }
+    uint64_t ns = latency_now() - trailer.s_sent;
+    LatencyHistogram * hist = (LatencyHistogram *)task->latency + task->local_pid * LATENCY_TYPES + type;
+    hist->count++;
+    hist->max = (ns > hist->max) ? ns : hist->max;
+    hist->buckets[latency_bucket(ns)]++;
+}
@@ -10,28 +10,76 @@
 #include "common.h"
 #include "ipc.h"
 #include "pa2345.h"
+#include "binlog.h"
+#include "evlog.h"
+#include "ipc_ext.h"
+#include "latency.h"
 #include "pipes.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timeline.h"
+#include "workload.h"
 #include "proc.h"
 
 
 #define PA3_MAX(x,y) ((x > y)?x:y)
+#define PA3_MAX_EXT_PROC 30
 
-timestamp_t g_time = 0;
+// wide enough for long workloads, classic messages carry the low bits
+timestamp_ext_t g_time = 0;
+// -x: stamp messages with the whole clock
+int g_ext = 0;
 
-timestamp_t time_cmp_and_set(timestamp_t time)
+timestamp_ext_t time_cmp_and_set(timestamp_ext_t time)
 {
     g_time = PA3_MAX(g_time, time);
     return g_time;
 }
 
-timestamp_t time_inc()
+timestamp_ext_t time_inc()
 { return ++g_time; }
 
 timestamp_t get_lamport_time()
 { return g_time; }
 
+/// lines of pa2345.h past the time, which log_time writes
+static const char * const log_started_tail_fmt =
+    ": process %1d (pid %5d, parent %5d) has STARTED with balance $%2d\n";
+
+static const char * const log_received_all_started_tail_fmt =
+    ": process %1d received all STARTED messages\n";
+
+static const char * const log_done_tail_fmt =
+    ": process %1d has DONE with balance $%2d\n";
+
+static const char * const log_transfer_out_tail_fmt =
+    ": process %1d transferred $%2d to process %1d\n";
+
+static const char * const log_transfer_in_tail_fmt =
+    ": process %1d received $%2d from process %1d\n";
+
+static const char * const log_received_all_done_tail_fmt =
+    ": process %1d received all DONE messages\n";
+
+/**
+ * Time in front of a log line, the whole clock with -x where
+ * timestamp_t of get_lamport_time would wrap
+ *
+ * @return number of chars written
+ */
+static int log_time(char * buf, timestamp_ext_t time)
+{
+    if (g_ext) {
+        return sprintf(buf, "%lld", (long long)time);
+    }
+    return sprintf(buf, "%d", (timestamp_t)time);
+}
+
 int event_log(TaskStruct * this, const char * msg, int length)
 {
+    if (this->evlog) {
+        return evlog_append(this->local_pid, g_time, msg, length);
+    }
     write(STDOUT_FILENO, msg, length);
     return (write(this->events_log_fd, msg, length) < 0) ? -1 : 0;
 }
@@ -44,9 +92,9 @@ int create_message(Message * msg, MessageType type, const MessagePayload * paylo
     header.s_local_time = get_lamport_time();
 
     if (payload == NULL) {
-        msg->s_header.s_payload_len = 0;
         msg->s_header = header;
-        return 0;
+        msg->s_header.s_payload_len = 0;
+        return g_ext ? ext_wrap(msg, g_time, msg) : 0;
     }
 
     if (payload->s_size > MAX_PAYLOAD_LEN) {
@@ -56,7 +104,20 @@ int create_message(Message * msg, MessageType type, const MessagePayload * paylo
 
     msg->s_header = header;
     memcpy(msg->s_payload, payload->s_data, payload->s_size);
-    return 0;
+    return g_ext ? ext_wrap(msg, g_time, msg) : 0;
+}
+
+/**
+ * Stamp a message made by create_message with the current time
+ *
+ * @return 0 on success, -1 if the payload leaves no room for the trailer
+ */
+static int stamp_message(Message * msg)
+{
+    msg->s_header.s_payload_len = ext_payload_len(msg);
+    msg->s_header.s_magic = MESSAGE_MAGIC;
+    msg->s_header.s_local_time = get_lamport_time();
+    return g_ext ? ext_wrap(msg, g_time, msg) : 0;
 }
 
 void transfer(void * parent_data, local_id src, local_id dst, balance_t amount)
@@ -80,12 +141,25 @@ void transfer(void * parent_data, local_id src, local_id dst, balance_t amount)
         send(this, src, &msg);
     }
     else {
+        if (this->transfer_queue_len == this->transfer_queue_cap) {
+            this->transfer_queue_cap = this->transfer_queue_cap ? 2 * this->transfer_queue_cap : this->total_proc;
+            this->transfer_queue = realloc(this->transfer_queue, sizeof(Message) * this->transfer_queue_cap);
+            if (this->transfer_queue == NULL) {
+                perror("transfer queue realloc error");
+                exit(EXIT_FAILURE);
+            }
+        }
         this->transfer_queue[this->transfer_queue_len++] = msg;
     }
 }
 
-timestamp_t push_history(BalanceHistory * history, timestamp_t last_time, timestamp_t send_time, balance_t balance, balance_t incoming, timestamp_t time)
+timestamp_t push_history(BalanceHistory * history, timestamp_t last_time, timestamp_ext_t send_time, balance_t balance, balance_t incoming, timestamp_ext_t time)
 {
+    // a long workload outruns the history, later states aren't kept;
+    // s_history_len is 8-bit, so the last one is at MAX_T - 1
+    if (time < 0 || time >= MAX_T) {
+        return last_time;
+    }
     for (timestamp_t i = last_time; i < time; i++) {
         history->s_history[i].s_balance = balance;
         history->s_history[i].s_time = i;
@@ -119,6 +193,23 @@ enum department_state {
 };
 typedef enum department_state department_state;
 
+// names for the timeline, in the order of department_state
+static const char * department_state_names[] = {
+    "d_initial",
+    "d_send_started",
+    "d_handle_messages",
+    "d_handle_out_transfer",
+    "d_handle_in_transfer",
+    "d_handle_stop",
+    "d_handle_done",
+    "d_send_transfer",
+    "d_send_ack",
+    "d_send_done",
+    "d_all_done",
+    "d_failed_finish",
+    "d_finish"
+};
+
 void department_fsm(TaskStruct * this)
 {
     department_state state = d_initial;
@@ -127,25 +218,29 @@ void department_fsm(TaskStruct * this)
     char log_msg[MAX_PAYLOAD_LEN];
 
     int done_n = 0;
+    int stopped = 0;
 
     int next = 1;
     while (next) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, department_state_names[state], g_time);
+        }
+        stats_state(state, department_state_names[state]);
         switch (state) {
         case d_initial: {
             close_redundant_pipes(this);
 
-            msg = malloc(sizeof(Message));
             state = d_send_started;
         } break;
         case d_send_started: {
             time_inc();
-            int symb = sprintf(log_msg,
-                               log_started_fmt,
-                               get_lamport_time(),
-                               this->local_pid,
-                               getpid(),
-                               getppid(),
-                               this->balance);
+            int symb = log_time(log_msg, g_time);
+            symb += sprintf(log_msg + symb,
+                            log_started_tail_fmt,
+                            this->local_pid,
+                            getpid(),
+                            getppid(),
+                            this->balance);
 
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("write ev_log error");
@@ -153,20 +248,25 @@ void department_fsm(TaskStruct * this)
                 continue;
             }
             MessagePayload payload = (MessagePayload) { log_msg, symb + 1 };
-            if (RC_FAIL(create_message(msg, STARTED, &payload))) {
+            Message started;
+            if (RC_FAIL(create_message(&started, STARTED, &payload))) {
                 printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
                 state = d_failed_finish;
                 continue;
             }
-            send(this, 0 /* is always manager */, msg);
+            send(this, 0 /* is always manager */, &started);
 
             state = d_handle_messages;
         } break;
         case d_handle_messages: {
-            int status = receive_any(this, msg);
-            (void)time_cmp_and_set(msg->s_header.s_local_time);
-            (void)time_inc();
-            if (RC_OK(status)) {
+            // slot of the received batch, states below may reuse it
+            // as scratch until the next receive_next
+            node_id from;
+            Message * in = receive_next(this, &from);
+            if (in != NULL) {
+                msg = in;
+                (void)time_cmp_and_set(ext_time(msg));
+                (void)time_inc();
                 switch (msg->s_header.s_type) {
                 case DONE:
                     state = d_handle_done;
@@ -183,17 +283,21 @@ void department_fsm(TaskStruct * this)
         } break;
         case d_handle_out_transfer: {
             TransferOrder * order = (TransferOrder *)msg->s_payload;
-            msg->s_header.s_local_time = time_inc();
-            timestamp_t time = msg->s_header.s_local_time;
-            this->last_time = push_history(&this->history, this->last_time, msg->s_header.s_local_time, this->balance, -order->s_amount, time);
+            timestamp_ext_t time = time_inc();
+            if (RC_FAIL(stamp_message(msg))) {
+                printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
+                state = d_failed_finish;
+                continue;
+            }
+            this->last_time = push_history(&this->history, this->last_time, time, this->balance, -order->s_amount, time);
             this->balance -= order->s_amount;
 
-            int symb = sprintf(log_msg,
-                               log_transfer_out_fmt,
-                               time,
-                               order->s_src,
-                               order->s_amount,
-                               order->s_dst);
+            int symb = log_time(log_msg, time);
+            symb += sprintf(log_msg + symb,
+                            log_transfer_out_tail_fmt,
+                            order->s_src,
+                            order->s_amount,
+                            order->s_dst);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("write ev_log error");
                 state = d_failed_finish;
@@ -204,16 +308,16 @@ void department_fsm(TaskStruct * this)
         } break;
         case d_handle_in_transfer: {
             TransferOrder * order = (TransferOrder *)msg->s_payload;
-            timestamp_t time = time_inc();
-            this->last_time = push_history(&this->history, this->last_time, msg->s_header.s_local_time, this->balance, order->s_amount, time);
+            timestamp_ext_t time = time_inc();
+            this->last_time = push_history(&this->history, this->last_time, ext_time(msg), this->balance, order->s_amount, time);
             this->balance += order->s_amount;
 
-            int symb = sprintf(log_msg,
-                               log_transfer_in_fmt,
-                               time,
-                               order->s_dst,
-                               order->s_amount,
-                               order->s_src);
+            int symb = log_time(log_msg, time);
+            symb += sprintf(log_msg + symb,
+                            log_transfer_in_tail_fmt,
+                            order->s_dst,
+                            order->s_amount,
+                            order->s_src);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("write ev_log error");
                 state = d_failed_finish;
@@ -223,13 +327,15 @@ void department_fsm(TaskStruct * this)
             state = d_send_ack;
         } break;
         case d_handle_stop: {
+            stopped = 1;
             state = d_send_done;
         } break;
         case d_handle_done: {
             state = d_handle_messages;
 
             done_n++;
-            if (done_n == this->total_proc - 2) { //except manager and himself
+            //DONE of others may overtake our STOP
+            if (done_n == this->total_proc - 2 && stopped) { //except manager and himself
                 state = d_all_done;
             }
         } break;
@@ -250,11 +356,11 @@ void department_fsm(TaskStruct * this)
         } break;
         case d_send_done: {
             (void)time_inc();
-            int symb = sprintf(log_msg,
-                               log_done_fmt,
-                               get_lamport_time(),
-                               this->local_pid,
-                               this->balance);
+            int symb = log_time(log_msg, g_time);
+            symb += sprintf(log_msg + symb,
+                            log_done_tail_fmt,
+                            this->local_pid,
+                            this->balance);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("write ev_log error");
                 state = d_failed_finish;
@@ -269,23 +375,23 @@ void department_fsm(TaskStruct * this)
             }
 
             send_multicast(this, msg);
-            state = d_handle_messages;
+            state = (done_n == this->total_proc - 2) ? d_all_done : d_handle_messages;
         } break;
         case d_all_done: {
             state = d_finish;
 
-            timestamp_t time = time_inc();
-            int symb = sprintf(log_msg,
-                               log_received_all_done_fmt,
-                               time,
-                               this->local_pid);
+            timestamp_ext_t time = time_inc();
+            int symb = log_time(log_msg, time);
+            symb += sprintf(log_msg + symb,
+                            log_received_all_done_tail_fmt,
+                            this->local_pid);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("event_log failed");
                 state = d_failed_finish;
             }
 
             //refresh history
-            this->last_time = push_history(&this->history, this->last_time, get_lamport_time(), this->balance, 0, time);
+            this->last_time = push_history(&this->history, this->last_time, g_time, this->balance, 0, time);
 
             int balance_size = sizeof(BalanceHistory) - sizeof(this->history.s_history) + sizeof(BalanceState) * this->history.s_history_len;
             MessagePayload payload = (MessagePayload){(char *)&this->history, balance_size};
@@ -301,12 +407,28 @@ void department_fsm(TaskStruct * this)
             exit(EXIT_FAILURE);
         } break;
         case d_finish: {
+            send_flush(this);
             exit(EXIT_SUCCESS);
         } break;
         }
     }
 }
 
+/*
+ * print_history takes AllHistory of MAX_PROCESS_ID + 1 departments,
+ * more of them are printed in several tables
+ */
+void print_all_history(const BalanceHistory * histories, int len)
+{
+    AllHistory all_history;
+    for (int off = 0; off < len; off += MAX_PROCESS_ID + 1) {
+        int chunk = (len - off < MAX_PROCESS_ID + 1) ? len - off : MAX_PROCESS_ID + 1;
+        all_history.s_history_len = chunk;
+        memcpy(all_history.s_history, histories + off, sizeof(BalanceHistory) * chunk);
+        print_history(&all_history);
+    }
+}
+
 /*
  * FSM for transfer manage
  */
@@ -327,30 +449,55 @@ enum manager_state {
 };
 typedef enum manager_state manager_state;
 
+// names for the timeline, in the order of manager_state
+static const char * manager_state_names[] = {
+    "m_initial",
+    "m_handle_messages",
+    "m_handle_started",
+    "m_handle_done",
+    "m_handle_ack",
+    "m_handle_balance_history",
+    "m_send_stop",
+    "m_all_started",
+    "m_all_done",
+    "m_all_balances",
+    "m_failed_finish",
+    "m_finish"
+};
+
 void manager_fsm(TaskStruct * this)
 {
     manager_state state = m_initial;
 
-    Message * msg;
-    AllHistory all_history = {0};
+    const Message * msg;
+    Message out;
+    // one slot per department, AllHistory holds MAX_PROCESS_ID + 1 at most
+    BalanceHistory * histories = calloc(this->total_proc - 1, sizeof(BalanceHistory));
+    int histories_len = 0;
     char log_msg[MAX_PAYLOAD_LEN];
 
     int started_n = 0;
     int done_n = 0;
+    int truncated = 0;
 
     int next = 1;
     while (next) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, manager_state_names[state], g_time);
+        }
+        stats_state(state, manager_state_names[state]);
         switch (state) {
         case m_initial: {
-            msg = malloc(sizeof(Message));
             state = m_handle_messages;
             this->transfer_queue_ack = 1;
         } break;
         case m_handle_messages: {
-            int status = receive_any(this, msg);
-            (void)time_cmp_and_set(msg->s_header.s_local_time);
-            (void)time_inc();
-            if (RC_OK(status)) {
+            // read in place, the view is released by the next receive_view
+            node_id from;
+            msg = receive_view(this, &from);
+            if (msg != NULL) {
+                (void)time_cmp_and_set(ext_time(msg));
+                (void)time_inc();
                 switch (msg->s_header.s_type) {
                 case STARTED:
                     state = m_handle_started;
@@ -385,56 +532,78 @@ void manager_fsm(TaskStruct * this)
         } break;
         case m_handle_ack: {
             state = m_handle_messages;
-            Message * msg = &this->transfer_queue[this->transfer_queue_index];
-            msg->s_header.s_local_time = time_inc();
-            const TransferOrder * order = (const TransferOrder *)msg->s_payload;
-            this->transfer_queue_index++;
+            if (this->workload != NULL) {
+                workload_ack(this);
+            }
+            (void)time_inc();
             this->transfer_queue_ack = 1;
-            if (this->transfer_queue_index > this->transfer_queue_len) {
-                state = m_send_stop;
+            if (this->transfer_queue_index == this->transfer_queue_len) {
+                // queue is drained, start it over for the next burst if any
+                this->transfer_queue_index = 0;
+                this->transfer_queue_len = 0;
+                if (this->workload == NULL || workload_next(this) == 0) {
+                    state = m_send_stop;
+                }
                 continue;
             }
+            Message * msg = &this->transfer_queue[this->transfer_queue_index++];
+            if (RC_FAIL(stamp_message(msg))) {
+                printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
+                state = m_failed_finish;
+                continue;
+            }
+            const TransferOrder * order = (const TransferOrder *)msg->s_payload;
             send(this, order->s_src, msg);
         } break;
         case m_handle_balance_history: {
             state = m_handle_messages;
 
-            BalanceHistory * history = (BalanceHistory *)msg->s_payload;
-            all_history.s_history[all_history.s_history_len++] = *history;
+            // only the filled part of the history travels in the payload
+            const BalanceHistory * history = (const BalanceHistory *)msg->s_payload;
+            size_t len = ext_payload_len(msg) < sizeof(*history) ? ext_payload_len(msg) : sizeof(*history);
+            memcpy(&histories[histories_len++], history, len);
+            if (this->workload != NULL) {
+                workload_history(this, ext_time(msg));
+            }
 
-            if (all_history.s_history_len == this->total_proc - 1) {
+            if (histories_len == this->total_proc - 1) {
                 state = m_all_balances;
             }
         } break;
         case m_all_started: {
             state = m_handle_messages;
 
-            int symb = sprintf(log_msg,
-                               log_received_all_started_fmt,
-                               time_inc(),
-                               this->local_pid);
+            int symb = log_time(log_msg, time_inc());
+            symb += sprintf(log_msg + symb,
+                            log_received_all_started_tail_fmt,
+                            this->local_pid);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("event_log failed");
                 state = m_failed_finish;
             }
-            bank_robbery(this, this->total_proc - 1);
+            if (this->workload == NULL) {
+                bank_robbery(this, this->total_proc - 1);
+            }
+            else if (RC_FAIL(workload_start(this))) {
+                state = m_failed_finish;
+            }
         } break;
         case m_send_stop: {
             time_inc();
-            if (RC_FAIL(create_message(msg, STOP, NULL))) {
+            if (RC_FAIL(create_message(&out, STOP, NULL))) {
                 printf("%s[%d]: Can not create message\n", __FILE__, __LINE__);
                 state = m_failed_finish;
                 continue;
             }
 
-            send_multicast(this, msg);
+            send_multicast(this, &out);
             state = m_handle_messages;
         } break;
         case m_all_done: {
-            int symb = sprintf(log_msg,
-                               log_received_all_done_fmt,
-                               get_lamport_time(),
-                               this->local_pid);
+            int symb = log_time(log_msg, g_time);
+            symb += sprintf(log_msg + symb,
+                            log_received_all_done_tail_fmt,
+                            this->local_pid);
             if (RC_FAIL(event_log(this, log_msg, symb))) {
                 perror("event_log failed");
                 state = m_failed_finish;
@@ -443,7 +612,11 @@ void manager_fsm(TaskStruct * this)
             state = m_handle_messages;
         } break;
         case m_all_balances: {
-            print_history(&all_history);
+            print_all_history(histories, histories_len);
+            if (this->workload != NULL && (truncated = workload_finish(this)) < 0) {
+                state = m_failed_finish;
+                continue;
+            }
 
             state = m_finish;
         } break;
@@ -451,13 +624,14 @@ void manager_fsm(TaskStruct * this)
             exit(EXIT_FAILURE);
         } break;
         case m_finish: {
-            for (local_id i = 0; i < this->total_proc - 1; i++) {
+            send_flush(this);
+            for (node_id i = 0; i < this->total_proc - 1; i++) {
                 if (wait(NULL) == -1) {
                     perror("wait error");
                     exit(EXIT_FAILURE);
                 }
             }
-            exit(EXIT_SUCCESS);
+            exit(truncated ? EXIT_FAILURE : EXIT_SUCCESS);
         } break;
         }
     }
@@ -470,60 +644,132 @@ int main(int argc, char * argv[])
         return 1;
     }
     int proc_count = 0;
-    switch (getopt(argc, argv, "p:")) {
-    case 'p':
-        proc_count = atoi(optarg);
-        break;
-    case -1:
-        exit(EXIT_FAILURE);
-    case '?':
-        exit(EXIT_FAILURE);
+    int transport = TRANSPORT_PIPE;
+    int multicast = MULTICAST_FLAT;
+    int spawn_type = SPAWN_FLAT;
+    int lazy = 0;
+    int binlog = 0;
+    int evlog = 0;
+    int timeline = 0;
+    int stats = 0;
+    int latency = 0;
+    Workload * workload = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:t:m:s:lxBELSHW:")) != -1) {
+        switch (opt) {
+        case 'p':
+            proc_count = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            if ((multicast = multicast_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown multicast %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            if ((spawn_type = spawn_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown spawn %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            lazy = 1;
+            break;
+        case 'x':
+            g_ext = 1;
+            break;
+        case 'B':
+            binlog = 1;
+            break;
+        case 'E':
+            evlog = 1;
+            break;
+        case 'L':
+            timeline = 1;
+            break;
+        case 'S':
+            stats = 1;
+            break;
+        case 'H':
+            latency = 1;
+            break;
+        case 'W':
+            if ((workload = workload_parse(optarg)) == NULL) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case '?':
+            exit(EXIT_FAILURE);
+        }
     }
 
-    if (proc_count <= 0 || proc_count > 10) {
+    // BalanceHistory keeps MAX_T ticks and bank_robbery takes
+    // about 8 Lamport ticks per department
+    if (proc_count <= 0 || proc_count > (g_ext ? PA3_MAX_EXT_PROC : 10)) {
         fprintf(stderr, "Invalid amount of child processes to create\n");
         exit(EXIT_FAILURE);
     }
 
-#define ARG_OFFSET 3
-    if (proc_count + ARG_OFFSET != argc) {
+    //balances follow the options
+    char ** balances = argv + optind;
+    if (proc_count != argc - optind) {
         fprintf(stderr, "Bad list of balances for given amount of processes\n");
         exit(EXIT_FAILURE);
     }
+    if (workload != NULL && RC_FAIL(workload_balances(workload, balances, proc_count))) {
+        exit(EXIT_FAILURE);
+    }
 
     TaskStruct task = {0};
     task.total_proc = proc_count + 1;
     task.local_pid = 0;
-
-    if ((task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    task.transport = transport;
+    task.multicast = multicast;
+    task.spawn = spawn_type;
+    task.lazy = lazy;
+    task.binlog = binlog;
+    task.evlog = evlog;
+    task.timeline = timeline;
+    task.workload = workload;
+
+    // with segments events.log is made by evlog_merge
+    task.events_log_fd = -1;
+    if (!evlog && (task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("events log open error");
         exit(EXIT_FAILURE);
     }
-    if ((task.pipe_log_fd = open(pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    if ((task.pipe_log_fd = open(binlog ? BINLOG_FILE : pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("pipe log open error");
         exit(EXIT_FAILURE);
     }
 
+    if (stats && RC_FAIL(stats_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
+    if (latency && RC_FAIL(latency_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
     if (RC_FAIL(pipe_init(&task))) {
         perror("pipe init failed");
         exit(EXIT_FAILURE);
     }
 
-    for (local_id i = 1; i < task.total_proc; i++) {
-        switch (fork()) {
-        case -1:
-            perror("fork error");
-            exit(EXIT_FAILURE);
-        case 0: {
-            TaskStruct this = task;
-            this.local_pid = i;
-            this.history.s_id = i;
-            this.balance = atoi(argv[i + ARG_OFFSET - 1]);
-            department_fsm(&this);
-        } break;
-        default:
-            break;
-        }
+    node_id id = spawn(&task);
+    if (id < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (id != PARENT_ID) {
+        TaskStruct this = task;
+        this.local_pid = id;
+        this.history.s_id = id;
+        this.balance = atoi(balances[id - 1]);
+        department_fsm(&this);
     }
 
     close_redundant_pipes(&task);
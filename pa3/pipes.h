@@ -5,21 +5,87 @@
 #include <stdlib.h>
 
 #include "common.h"
+#include "frame.h"
 #include "ipc.h"
 #include "proc.h"
 
 #define OUTCOMING 1
 #define INCOMING  0
 
+#define RECEIVE_BATCH_SIZE 16
+
 int pipe_init(TaskStruct * task);
 
-int get_pipe(TaskStruct * task, local_id requested, local_id base);
+int get_pipe(TaskStruct * task, node_id requested, node_id base);
 
 int close_redundant_pipes(TaskStruct * task);
 
-int get_recipient(TaskStruct * task, local_id dst);
+int poll_init(TaskStruct * task);
+
+/** @return write end of the pipe to dst, -1 if there is none */
+static inline int get_recipient(TaskStruct * task, node_id dst)
+{
+    return task->channels[dst].wr;
+}
+
+/** @return read end of the pipe from the peer, -1 if there is none */
+static inline int get_sender(TaskStruct * task, node_id from)
+{
+    return task->channels[from].rd;
+}
+
+int transport_parse(const char * name);
+
+int multicast_parse(const char * name);
+
+/** Write out frames queued by send since the last commit.
+ *
+ * Doesn't block: whatever the pipes don't accept now
+ * is written once they become writable.
+ * receive, receive_any and receive_batch commit on their own.
+ *
+ * @return 0 on success, -1 on error
+ */
+int send_commit(void * self);
+
+/** Block until every queued frame is written. */
+int send_flush(void * self);
+
+/** Receive every message currently readable across all channels.
+ *
+ * Blocks until at least one message is there.
+ *
+ * @param out     Array of max messages allocated by the caller
+ * @param from    Array of max sender ids allocated by the caller
+ *
+ * @return number of messages received, -1 on error
+ */
+int receive_batch(void * self, Message * out, node_id * from, size_t max);
+
+/** Next message of the batch received by receive_batch,
+ * fetching a new batch once this one is used up.
+ *
+ * Returned message stays valid until the next call.
+ *
+ * @return message or NULL on error
+ */
+Message * receive_next(void * self, node_id * from);
+
+/** Receive next message without copying it out of the transport.
+ *
+ * Message is read-only and stays valid until release_view
+ * or the next receive_view, which releases it on its own.
+ * No other receive may be called while a view is held.
+ *
+ * @return message or NULL on error
+ */
+const Message * receive_view(void * self, node_id * from);
 
-int get_sender(TaskStruct * task, local_id from);
+/** Hand the message of the last receive_view back to the transport.
+ *
+ * @return 0 on success, -1 on error
+ */
+int release_view(void * self);
 
-int pipe_log(TaskStruct * task, local_id pid, const Message * msg, int direction);
+int pipe_log(TaskStruct * task, node_id pid, const Message * msg, int direction);
 #endif
@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "ring.h"
+#include "stats.h"
+
+/* Shared memory transport
+ *
+ * One anonymous shared mapping is created before fork
+ * and inherited by every process:
+ *
+ *    +------------+------------+-----+-----------+-----------+-----+
+ *    | doorbell 0 | doorbell 1 | ... | ring 0->1 | ring 0->2 | ... |
+ *    +------------+------------+-----+-----------+-----------+-----+
+ *
+ * Each directed channel is a single-producer/single-consumer
+ * byte ring with free running head and tail counters kept on
+ * separate cache lines. Frames are stored as they go to the pipe,
+ * MessageHeader followed by payload, but every frame starts at
+ * a multiple of RING_ALIGN so it can be read in place.
+ *
+ * Doorbell of a process is a futex word the process sleeps on
+ * once all its rings are empty. Producers bump it only if the
+ * owner announced it is going to sleep, so while everybody is
+ * busy send and receive do not enter the kernel at all.
+ *
+ * A frame that doesn't fit a full ring is queued in process memory,
+ * the way frame.c queues what a full pipe doesn't take, and so is
+ * every later frame to the same peer to keep the order. Queues are
+ * pushed on every send, receive and wait, so two processes filling
+ * each other's rings go on draining their own instead of waiting
+ * for one another. A process marks its doorbell once it exits, and
+ * sends to it fail with EPIPE from then on, as with a pipe.
+ */
+
+enum {
+    CACHE_LINE = 64,
+    RING_SIZE = 1 << 16, ///< must be power of two and hold a max-sized frame
+    RING_SPIN = 64,      ///< empty scans before going to sleep on SMP
+    RING_ALIGN = 8,
+    RING_NAP_NS = 1000000 ///< sleep with queued frames, nobody rings for free room
+};
+
+typedef struct {
+    uint32_t head __attribute__((aligned(CACHE_LINE))); ///< written by consumer
+    uint32_t tail __attribute__((aligned(CACHE_LINE))); ///< written by producer
+    char data[RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+} Ring;
+
+typedef struct {
+    uint32_t seq;      ///< futex word
+    uint32_t sleeping; ///< owner is about to wait on seq
+    uint32_t gone;     ///< owner has exited, its rings are never drained again
+} __attribute__((aligned(CACHE_LINE))) Doorbell;
+
+/// Doorbell to mark at exit
+static Doorbell * ring_self = NULL;
+
+static Doorbell * ring_doorbell(TaskStruct * task, node_id pid)
+{
+    return (Doorbell *)task->shm + pid;
+}
+
+static Ring * ring_get(TaskStruct * task, node_id from, node_id to)
+{
+    int n = task->total_proc;
+    Ring * rings = (Ring *)((Doorbell *)task->shm + n);
+    return rings + from * (n - 1) + ((to < from) ? to : to - 1);
+}
+
+int ring_init(TaskStruct * task)
+{
+    int n = task->total_proc;
+    task->shm_size = sizeof(Doorbell) * n + sizeof(Ring) * n * (n - 1);
+    task->shm = mmap(NULL, task->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (task->shm == MAP_FAILED) {
+        perror("ring_init mmap error");
+        return -1;
+    }
+
+    // fresh anonymous mapping is zeroed: all rings empty, nobody sleeps
+    task->ring_next = 0;
+    // on a single cpu the producer can't run while we spin
+    task->ring_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? RING_SPIN : 1;
+    return 0;
+}
+
+static void ring_leave(void)
+{
+    __atomic_store_n(&ring_self->gone, 1, __ATOMIC_SEQ_CST);
+}
+
+int ring_attach(TaskStruct * task)
+{
+    ring_self = ring_doorbell(task, task->local_pid);
+    if (RC_FAIL(atexit(ring_leave))) {
+        perror("ring_attach atexit error");
+        return -1;
+    }
+    return 0;
+}
+
+static uint32_t ring_frame_size(uint32_t len)
+{
+    return (len + RING_ALIGN - 1) & ~(uint32_t)(RING_ALIGN - 1);
+}
+
+static void ring_copy_in(Ring * ring, uint32_t pos, const void * src, size_t len)
+{
+    size_t off = pos & (RING_SIZE - 1);
+    size_t first = (len < RING_SIZE - off) ? len : RING_SIZE - off;
+    memcpy(ring->data + off, src, first);
+    memcpy(ring->data, (const char *)src + first, len - first);
+}
+
+static void ring_copy_out(const Ring * ring, uint32_t pos, void * dst, size_t len)
+{
+    size_t off = pos & (RING_SIZE - 1);
+    size_t first = (len < RING_SIZE - off) ? len : RING_SIZE - off;
+    memcpy(dst, ring->data + off, first);
+    memcpy((char *)dst + first, ring->data, len - first);
+}
+
+/**
+ * Copy frame into the ring to dst
+ *
+ * @return 0 on success, 1 if the ring has no room for it
+ */
+static int ring_put(TaskStruct * task, node_id dst, const void * frame, uint32_t len)
+{
+    Ring * ring = ring_get(task, task->local_pid, dst);
+    uint32_t size = ring_frame_size(len);
+    uint32_t tail = ring->tail;
+    if (RING_SIZE - (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) < size) {
+        return 1;
+    }
+
+    ring_copy_in(ring, tail, frame, len);
+    __atomic_store_n(&ring->tail, tail + size, __ATOMIC_SEQ_CST);
+
+    Doorbell * bell = ring_doorbell(task, dst);
+    if (__atomic_load_n(&bell->sleeping, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&bell->seq, 1, __ATOMIC_SEQ_CST);
+        stats_syscall();
+        syscall(SYS_futex, &bell->seq, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+
+    return 0;
+}
+
+/**
+ * Move frames queued for dst to its ring while they fit
+ *
+ * @return 0 if the queue is empty, 1 if something is still queued
+ */
+static int ring_push(TaskStruct * task, node_id dst)
+{
+    Channel * queue = &task->ring_out[dst];
+    size_t off = 0;
+    while (off < queue->out_len) {
+        MessageHeader header;
+        memcpy(&header, queue->out + off, sizeof(header));
+        uint32_t len = sizeof(MessageHeader) + header.s_payload_len;
+        if (ring_put(task, dst, queue->out + off, len) > 0) {
+            break;
+        }
+        off += len;
+    }
+    queue->out_len -= off;
+    memmove(queue->out, queue->out + off, queue->out_len);
+    return queue->out_len > 0;
+}
+
+static int ring_gone(TaskStruct * task, node_id dst)
+{
+    return __atomic_load_n(&ring_doorbell(task, dst)->gone, __ATOMIC_SEQ_CST);
+}
+
+int ring_send(TaskStruct * task, node_id dst, const Message * msg)
+{
+    if (dst == task->local_pid || dst < 0 || dst >= task->total_proc) {
+        return -1;
+    }
+    if (ring_gone(task, dst)) {
+        errno = EPIPE;
+        return -1;
+    }
+
+    uint32_t len = sizeof(MessageHeader) + msg->s_header.s_payload_len;
+    int queued = task->ring_out != NULL && task->ring_out[dst].out_len > 0 && ring_push(task, dst);
+    if (!queued && ring_put(task, dst, msg, len) == 0) {
+        return 0;
+    }
+
+    // receiver is behind, and may be sending to us meanwhile
+    if (task->ring_out == NULL && (task->ring_out = calloc(task->total_proc, sizeof(Channel))) == NULL) {
+        perror("ring_send calloc error");
+        return -1;
+    }
+    return frame_queue(&task->ring_out[dst], msg, len);
+}
+
+/**
+ * Push queued frames to every peer that has room for them
+ *
+ * @return 0 if nothing is queued anymore, 1 otherwise
+ */
+int ring_commit(TaskStruct * task)
+{
+    if (task->ring_out == NULL) {
+        return 0;
+    }
+    int queued = 0;
+    for (node_id dst = 0; dst < task->total_proc; dst++) {
+        if (task->ring_out[dst].out_len > 0 && ring_push(task, dst)) {
+            queued = 1;
+        }
+    }
+    return queued;
+}
+
+/**
+ * Wait until queued frames are in the rings, dropping those
+ * to peers that have exited
+ *
+ * @return 0 on success, -1 with EPIPE if some frames were dropped
+ */
+int ring_flush(TaskStruct * task)
+{
+    int rc = 0;
+    while (ring_commit(task)) {
+        for (node_id dst = 0; dst < task->total_proc; dst++) {
+            if (task->ring_out[dst].out_len > 0 && ring_gone(task, dst)) {
+                task->ring_out[dst].out_len = 0;
+                errno = EPIPE;
+                rc = -1;
+            }
+        }
+        sched_yield();
+    }
+    return rc;
+}
+
+int ring_receive(TaskStruct * task, node_id from, Message * msg)
+{
+    if (from == task->local_pid || from < 0 || from >= task->total_proc) {
+        return -1;
+    }
+
+    Ring * ring = ring_get(task, from, task->local_pid);
+    uint32_t head = ring->head;
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head) {
+        return -1;
+    }
+
+    ring_copy_out(ring, head, &msg->s_header, sizeof(MessageHeader));
+    ring_copy_out(ring, head + sizeof(MessageHeader), msg->s_payload, msg->s_header.s_payload_len);
+    __atomic_store_n(&ring->head, head + ring_frame_size(sizeof(MessageHeader) + msg->s_header.s_payload_len), __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int ring_ready(TaskStruct * task, node_id from)
+{
+    Ring * ring = ring_get(task, from, task->local_pid);
+    return __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) != ring->head;
+}
+
+static int ring_pending(TaskStruct * task)
+{
+    for (node_id from = 0; from < task->total_proc; from++) {
+        if (from != task->local_pid && ring_ready(task, from)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Wait until some ring has a frame
+ *
+ * @return sender of that ring
+ */
+static node_id ring_wait(TaskStruct * task)
+{
+    int n = task->total_proc;
+    int scans = 0;
+    while (1) {
+        // start where the previous call stopped to serve senders in turn
+        for (int i = 0; i < n; i++) {
+            node_id from = (task->ring_next + i) % n;
+            if (from != task->local_pid && ring_ready(task, from)) {
+                task->ring_next = (from + 1) % n;
+                return from;
+            }
+        }
+
+        // frames queued here may be what the other side waits for
+        // before it drains the rings we are waiting on
+        stats_empty_poll();
+        (void)ring_commit(task);
+        if (++scans < task->ring_spin) {
+            continue;
+        }
+        scans = 0;
+
+        // announce sleep first, then recheck, so producer either sees
+        // the flag or its frame is seen by the recheck
+        Doorbell * bell = ring_doorbell(task, task->local_pid);
+        uint32_t seq = __atomic_load_n(&bell->seq, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&bell->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (!ring_pending(task)) {
+            // room in a ring frees without a doorbell, come back for queued frames
+            struct timespec nap = {0, RING_NAP_NS};
+            stats_syscall();
+            syscall(SYS_futex, &bell->seq, FUTEX_WAIT, seq, ring_commit(task) ? &nap : NULL, NULL, 0);
+        }
+        __atomic_store_n(&bell->sleeping, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+int ring_receive_any(TaskStruct * task, Message * msg)
+{
+    node_id from = ring_wait(task);
+    if (RC_FAIL(ring_receive(task, from, msg))) {
+        return -1;
+    }
+    return from;
+}
+
+/**
+ * Wait for a frame and leave it in the ring
+ *
+ * @param scratch Copy of the frame if it wraps around the end of the ring
+ * @param view    Message of the frame
+ *
+ * @return sender of the frame
+ */
+node_id ring_peek(TaskStruct * task, Message * scratch, const Message ** view)
+{
+    node_id from = ring_wait(task);
+    Ring * ring = ring_get(task, from, task->local_pid);
+    uint32_t head = ring->head;
+    size_t off = head & (RING_SIZE - 1);
+
+    // aligned header never wraps, payload may
+    const Message * frame = (const Message *)(ring->data + off);
+    size_t len = sizeof(MessageHeader) + frame->s_header.s_payload_len;
+    if (off + len > RING_SIZE) {
+        ring_copy_out(ring, head, scratch, len);
+        frame = scratch;
+    }
+
+    *view = frame;
+    return from;
+}
+
+/**
+ * Drop the frame returned by ring_peek
+ */
+void ring_drop(TaskStruct * task, node_id from)
+{
+    Ring * ring = ring_get(task, from, task->local_pid);
+    uint32_t head = ring->head;
+    const MessageHeader * header = (const MessageHeader *)(ring->data + (head & (RING_SIZE - 1)));
+    __atomic_store_n(&ring->head, head + ring_frame_size(sizeof(MessageHeader) + header->s_payload_len), __ATOMIC_RELEASE);
+}
+
+int ring_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max)
+{
+    int first = ring_receive_any(task, &out[0]);
+    if (first < 0) {
+        return -1;
+    }
+    from[0] = first;
+
+    // rest of the pass is plain memory reads, drain every ring
+    size_t len = 1;
+    int n = task->total_proc;
+    for (int i = 0; i < n && len < max; i++) {
+        node_id peer = (task->ring_next + i) % n;
+        if (peer == task->local_pid) {
+            continue;
+        }
+        while (len < max && RC_OK(ring_receive(task, peer, &out[len]))) {
+            from[len++] = peer;
+        }
+    }
+
+    return len;
+}
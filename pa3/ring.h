@@ -0,0 +1,26 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+int ring_init(TaskStruct * task);
+
+int ring_attach(TaskStruct * task);
+
+int ring_send(TaskStruct * task, node_id dst, const Message * msg);
+
+int ring_commit(TaskStruct * task);
+
+int ring_flush(TaskStruct * task);
+
+int ring_receive(TaskStruct * task, node_id from, Message * msg);
+
+int ring_receive_any(TaskStruct * task, Message * msg);
+
+node_id ring_peek(TaskStruct * task, Message * scratch, const Message ** view);
+
+void ring_drop(TaskStruct * task, node_id from);
+
+int ring_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max);
+#endif
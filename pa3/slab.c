@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+/* Shared slabs for multicast
+ *
+ * Multicast over pipes or rings copies the same frame once per peer
+ * on the way in and once per peer on the way out. Instead, the frame
+ * is stored once in a slab of a shared mapping created before fork,
+ * and peers get a reference frame of a few bytes:
+ *
+ *    +-------------------------------------+---------+
+ *    | MessageHeader (magic = SLAB_MAGIC,  | SlabRef |
+ *    | type and time of the real message)  |         |
+ *    +-------------------------------------+---------+
+ *
+ * Every process owns SLAB_COUNT slabs and only writes to its own.
+ * Slab keeps a count of peers that haven't taken the message yet,
+ * the last one frees it. If all slabs of the sender are still held,
+ * multicast falls back to plain frames.
+ */
+
+enum {
+    SLAB_ALIGN = 64,
+    SLAB_COUNT = 16
+};
+
+typedef struct {
+    uint32_t refs; ///< peers yet to take the message
+    Message msg;
+} __attribute__((aligned(SLAB_ALIGN))) Slab;
+
+typedef struct {
+    uint32_t slab;
+} SlabRef;
+
+static Slab * slab_get(TaskStruct * task, uint32_t index)
+{
+    return (Slab *)task->slabs + index;
+}
+
+int slab_init(TaskStruct * task)
+{
+    if (task->total_proc < 3) {
+        // single receiver, nothing to share
+        task->slabs = NULL;
+        return 0;
+    }
+
+    task->slabs_size = sizeof(Slab) * SLAB_COUNT * task->total_proc;
+    task->slabs = mmap(NULL, task->slabs_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (task->slabs == MAP_FAILED) {
+        perror("slab_init mmap error");
+        return -1;
+    }
+
+    // fresh anonymous mapping is zeroed: every slab is free
+    task->slab_next = 0;
+    return 0;
+}
+
+/**
+ * Store message in a free slab of the caller for all its peers
+ *
+ * @param ref     Reference frame to send instead of the message
+ *
+ * @return 0 on success, -1 if there is no slab to use
+ */
+int slab_publish(TaskStruct * task, const Message * msg, Message * ref)
+{
+    if (task->slabs == NULL || msg->s_header.s_payload_len <= sizeof(SlabRef)) {
+        return -1;
+    }
+
+    for (int i = 0; i < SLAB_COUNT; i++) {
+        uint32_t index = task->local_pid * SLAB_COUNT + (task->slab_next + i) % SLAB_COUNT;
+        Slab * slab = slab_get(task, index);
+        if (__atomic_load_n(&slab->refs, __ATOMIC_ACQUIRE) != 0) {
+            continue;
+        }
+
+        memcpy(&slab->msg, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len);
+        // published by the send of the reference frame
+        __atomic_store_n(&slab->refs, task->total_proc - 1, __ATOMIC_RELEASE);
+        task->slab_next = (task->slab_next + i + 1) % SLAB_COUNT;
+
+        SlabRef slab_ref = {index};
+        ref->s_header = msg->s_header;
+        ref->s_header.s_magic = SLAB_MAGIC;
+        ref->s_header.s_payload_len = sizeof(slab_ref);
+        memcpy(ref->s_payload, &slab_ref, sizeof(slab_ref));
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @return message the reference frame points to
+ *         or NULL for plain frames
+ */
+const Message * slab_peek(TaskStruct * task, const Message * ref)
+{
+    if (ref->s_header.s_magic != SLAB_MAGIC) {
+        return NULL;
+    }
+
+    SlabRef slab_ref;
+    memcpy(&slab_ref, ref->s_payload, sizeof(slab_ref));
+    return &slab_get(task, slab_ref.slab)->msg;
+}
+
+/**
+ * Drop reference to the message got from slab_peek
+ */
+void slab_drop(TaskStruct * task, const Message * msg)
+{
+    Slab * slab = (Slab *)((const char *)msg - offsetof(Slab, msg));
+    __atomic_sub_fetch(&slab->refs, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Replace received reference frame by the message it points to
+ * and drop the reference. Plain frames are left as is
+ */
+void slab_resolve(TaskStruct * task, Message * msg)
+{
+    const Message * slab_msg = slab_peek(task, msg);
+    if (slab_msg == NULL) {
+        return;
+    }
+
+    memcpy(msg, slab_msg, sizeof(MessageHeader) + slab_msg->s_header.s_payload_len);
+    slab_drop(task, slab_msg);
+}
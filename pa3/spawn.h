@@ -0,0 +1,12 @@
+#ifndef SPAWN_H_
+#define SPAWN_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+node_id spawn(TaskStruct * task);
+
+int spawn_parse(const char * name);
+
+int close_fds(const char * drop, int count);
+#endif
@@ -0,0 +1,105 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "proc.h"
+
+/// Mapped by every process of the run, labstat reads it while the run goes on
+#define STATS_FILE "stats.bin"
+
+#define STATS_MAGIC 0x57A75u
+
+enum {
+    STATS_PAGE = 4096,     ///< pages of processes start on page boundaries
+    STATS_TYPES = CS_RELEASE + 1,
+    STATS_STATES = 16,     ///< states of an FSM that get a slot
+    STATS_NAME_LEN = 24
+};
+
+typedef struct {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+} StatsCounters;
+
+typedef struct {
+    uint32_t magic;
+    node_id nodes;
+    uint16_t reserved;
+    uint64_t page_size; ///< StatsPage and its channels, rounded up to STATS_PAGE
+} StatsHeader;
+
+typedef struct {
+    int32_t pid;                    ///< 0 until the process attaches
+    int32_t state;                  ///< FSM state the process is in, -1 before the first
+    uint64_t state_since;           ///< CLOCK_MONOTONIC ns the state was entered at
+    uint64_t eagain;                ///< reads and writes that would block
+    uint64_t empty_polls;           ///< passes of the receive path that found nothing
+    uint64_t syscalls;              ///< reads, writes and waits made by the transport
+    uint64_t state_ns[STATS_STATES]; ///< time in states left so far
+    char state_names[STATS_STATES][STATS_NAME_LEN];
+    StatsCounters types[STATS_TYPES];
+    StatsCounters channels[];       ///< indexed by peer
+} StatsPage;
+
+/// Page of the current process, NULL while stats are off
+extern StatsPage * stats_page;
+
+int stats_init(TaskStruct * task);
+
+int stats_attach(TaskStruct * task);
+
+void stats_state(int state, const char * name);
+
+static inline StatsPage * stats_page_of(void * base, node_id id)
+{
+    const StatsHeader * header = base;
+    return (StatsPage *)((char *)base + STATS_PAGE + id * header->page_size);
+}
+
+static inline void stats_add(StatsCounters * counters, uint64_t bytes, int outgoing)
+{
+    if (outgoing) {
+        counters->sent++;
+        counters->bytes_sent += bytes;
+    }
+    else {
+        counters->received++;
+        counters->bytes_received += bytes;
+    }
+}
+
+static inline void stats_message(node_id hop, const Message * msg, int outgoing)
+{
+    uint64_t bytes = sizeof(MessageHeader) + msg->s_header.s_payload_len;
+    stats_add(&stats_page->channels[hop], bytes, outgoing);
+    if (msg->s_header.s_type < STATS_TYPES) {
+        stats_add(&stats_page->types[msg->s_header.s_type], bytes, outgoing);
+    }
+}
+
+static inline void stats_eagain(void)
+{
+    if (stats_page != NULL) {
+        stats_page->eagain++;
+    }
+}
+
+static inline void stats_empty_poll(void)
+{
+    if (stats_page != NULL) {
+        stats_page->empty_polls++;
+    }
+}
+
+static inline void stats_syscall(void)
+{
+    if (stats_page != NULL) {
+        stats_page->syscalls++;
+    }
+}
+#endif
@@ -0,0 +1,18 @@
+#ifndef TREE_H_
+#define TREE_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+/// Marks a frame broadcast along the binomial tree
+#define TREE_MAGIC 0xAFB1
+
+/// Enough for any node_id range, log2(MAX_NODE_ID + 1) levels
+#define TREE_MAX_CHILDREN 32
+
+int tree_children(TaskStruct * task, node_id root, node_id * children);
+
+int tree_wrap(TaskStruct * task, const Message * msg, Message * out);
+
+node_id tree_unwrap(Message * msg);
+#endif
@@ -0,0 +1,550 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "pipes.h"
+#include "stats.h"
+#include "uring.h"
+
+/* io_uring backend of the pipe transport
+ *
+ * Same pipe mesh and framing as the pipe transport, but the pipe
+ * ends of the process are driven through one io_uring instance
+ * created after fork:
+ *
+ * - every incoming pipe has a read posted into the free tail of its
+ *   channel input buffer, reposted as soon as it completes
+ * - outbound frames and pipe log lines are queued in memory and
+ *   posted as one write per channel (the queue is swapped with a
+ *   spare buffer, so sends go on while the write is in flight)
+ * - everything prepared is submitted together with waiting for
+ *   completions in a single io_uring_enter, completions are reaped
+ *   in batches
+ *
+ * Pipe ends are switched to blocking mode, so the kernel parks a
+ * request on a full or empty pipe instead of failing it with EAGAIN.
+ *
+ * Only readv and writev are posted, the opcodes io_uring had from the
+ * start in 5.1, so a kernel that sets up a ring runs every request of
+ * this backend. If io_uring can't be set up the process stays on the
+ * pipe transport. A failed write is kept on its channel and the next
+ * send to the peer fails with its error, as a write to the pipe would.
+ */
+
+/* ABI of io_uring as of Linux 5.1, defined here as uapi headers of
+ * older toolchains don't have it
+ */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+
+#define URING_OFF_SQ_RING 0L
+#define URING_OFF_CQ_RING 0x8000000L
+#define URING_OFF_SQES 0x10000000L
+
+enum {
+    URING_OP_READV = 1,
+    URING_OP_WRITEV = 2,
+    URING_ENTER_GETEVENTS = 1
+};
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    uint64_t user_data;
+    uint64_t pad[3];
+} UringSqe;
+
+typedef struct {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+} UringCqe;
+
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t resv2;
+} UringSqOffsets;
+
+typedef struct {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t resv2;
+} UringCqOffsets;
+
+typedef struct {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    UringSqOffsets sq_off;
+    UringCqOffsets cq_off;
+} UringParams;
+
+enum {
+    URING_READ = 1,
+    URING_WRITE = 2
+};
+
+typedef struct {
+    int reading;    ///< read is posted
+    size_t read_off; ///< where the posted read lands in the input buffer
+    struct iovec read_iov;
+    int eof;
+
+    int writing;    ///< write is posted
+    char * wbuf;    ///< bytes handed over to the write
+    size_t wbuf_len;
+    size_t wbuf_off; ///< already written
+    size_t wbuf_cap;
+    struct iovec write_iov;
+    int error;      ///< errno of a failed write, sends to the peer fail from then on
+} UringChannel;
+
+struct Uring
+{
+    int fd;
+    void * sq_map;
+    size_t sq_len;
+    void * cq_map;
+    size_t cq_len;
+    size_t sqes_len;
+    unsigned * sq_head;
+    unsigned * sq_tail;
+    unsigned sq_mask;
+    unsigned * sq_array;
+    UringSqe * sqes;
+    unsigned * cq_head;
+    unsigned * cq_tail;
+    unsigned cq_mask;
+    UringCqe * cqes;
+    unsigned to_submit;
+
+    UringChannel * chans; ///< indexed by peer, pipe log goes last
+    Channel log;          ///< pipe log lines waiting for a write
+    node_id next;        ///< channel to look at first for a frame
+};
+
+static int uring_setup(Uring * ring, unsigned entries)
+{
+    UringParams params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) {
+        return -1;
+    }
+
+    ring->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(UringCqe);
+    ring->sqes_len = params.sq_entries * sizeof(UringSqe);
+    ring->sq_map = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, URING_OFF_SQ_RING);
+    ring->cq_map = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, URING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, URING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        return -1;
+    }
+
+    char * sq = ring->sq_map;
+    char * cq = ring->cq_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (UringCqe *)(cq + params.cq_off.cqes);
+    ring->to_submit = 0;
+    return 0;
+}
+
+/**
+ * Unmap and close whatever uring_setup got to, free the ring
+ */
+static void uring_close(Uring * ring)
+{
+    if (ring->sq_map != NULL && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_len);
+    }
+    if (ring->cq_map != NULL && ring->cq_map != MAP_FAILED) {
+        munmap(ring->cq_map, ring->cq_len);
+    }
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    free(ring->chans);
+    free(ring);
+}
+
+static int uring_blocking(int fd, int blocking)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+/**
+ * Switch all pipe ends of the process to blocking mode or back,
+ * going on past an end that fails
+ *
+ * @return 0 on success, -1 if some end failed
+ */
+static int uring_blocking_all(TaskStruct * task, int blocking)
+{
+    int rc = 0;
+    for (node_id peer = 0; peer < task->total_proc; peer++) {
+        if (peer == task->local_pid) {
+            continue;
+        }
+        if (RC_FAIL(uring_blocking(get_sender(task, peer), blocking))) {
+            rc = -1;
+        }
+        if (RC_FAIL(uring_blocking(get_recipient(task, peer), blocking))) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/**
+ * Set up the ring of the process, pipe ends are left as they are
+ * on failure, so the process can go on with the pipe transport
+ */
+int uring_init(TaskStruct * task)
+{
+    int n = task->total_proc;
+    Uring * ring = calloc(1, sizeof(Uring));
+    if (ring == NULL) {
+        return -1;
+    }
+    ring->fd = -1;
+
+    // a read and a write per channel plus the log write
+    unsigned entries = 1;
+    while (entries < 2 * (unsigned)n + 1) {
+        entries <<= 1;
+    }
+    ring->chans = calloc(n + 1, sizeof(UringChannel));
+    if (ring->chans == NULL || RC_FAIL(uring_setup(ring, entries))) {
+        uring_close(ring);
+        return -1;
+    }
+
+    // last, so a failure anywhere else leaves the ends untouched
+    if (RC_FAIL(uring_blocking_all(task, 1))) {
+        perror("uring_init fcntl error");
+        (void)uring_blocking_all(task, 0);
+        uring_close(ring);
+        return -1;
+    }
+
+    task->uring = ring;
+    return 0;
+}
+
+/**
+ * Post readv or writev of a single buffer, iov stays put until it completes
+ */
+static void uring_push(TaskStruct * task, int op, node_id peer, int fd, struct iovec * iov, void * buf, size_t len)
+{
+    Uring * ring = task->uring;
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & ring->sq_mask;
+
+    iov->iov_base = buf;
+    iov->iov_len = len;
+    UringSqe * sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (op == URING_READ) ? URING_OP_READV : URING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)iov;
+    sqe->len = 1;
+    sqe->off = 0; ///< ignored by pipes and by the O_APPEND log
+    sqe->user_data = ((uint64_t)op << 32) | (uint32_t)peer;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+}
+
+static void uring_arm_write(TaskStruct * task, node_id peer, Channel * ch, int fd)
+{
+    UringChannel * uc = &task->uring->chans[peer];
+    if (uc->writing || uc->error) {
+        return;
+    }
+    if (uc->wbuf_off == uc->wbuf_len) {
+        if (ch->out_len == 0) {
+            return;
+        }
+        // hand queued bytes over to the write, queue goes on in the spare buffer
+        char * out = ch->out;
+        size_t cap = ch->out_cap;
+        uc->wbuf_len = ch->out_len;
+        uc->wbuf_off = 0;
+        ch->out = uc->wbuf;
+        ch->out_cap = uc->wbuf_cap;
+        ch->out_len = 0;
+        uc->wbuf = out;
+        uc->wbuf_cap = cap;
+    }
+
+    uring_push(task, URING_WRITE, peer, fd, &uc->write_iov, uc->wbuf + uc->wbuf_off, uc->wbuf_len - uc->wbuf_off);
+    uc->writing = 1;
+}
+
+/**
+ * Prepare reads for idle channels and writes for pending output,
+ * nothing is submitted yet
+ */
+void uring_arm(TaskStruct * task)
+{
+    Uring * ring = task->uring;
+    for (node_id peer = 0; peer < task->total_proc; peer++) {
+        if (peer == task->local_pid) {
+            continue;
+        }
+        Channel * ch = &task->channels[peer];
+        UringChannel * uc = &ring->chans[peer];
+        if (!uc->reading && !uc->eof && ch->in_len < FRAME_BUF_SIZE) {
+            uring_push(task, URING_READ, peer, get_sender(task, peer), &uc->read_iov, ch->in + ch->in_len, FRAME_BUF_SIZE - ch->in_len);
+            uc->read_off = ch->in_len;
+            uc->reading = 1;
+        }
+        uring_arm_write(task, peer, ch, get_recipient(task, peer));
+    }
+    uring_arm_write(task, task->total_proc, &ring->log, task->pipe_log_fd);
+}
+
+static int uring_enter(TaskStruct * task, unsigned wait)
+{
+    Uring * ring = task->uring;
+    while (1) {
+        stats_syscall();
+        int rc = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, wait, wait ? URING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) {
+            ring->to_submit -= rc;
+            return 0;
+        }
+        if (errno != EINTR) {
+            perror("uring_enter error");
+            return -1;
+        }
+    }
+}
+
+static void uring_complete(TaskStruct * task, const UringCqe * cqe)
+{
+    int op = cqe->user_data >> 32;
+    node_id peer = (node_id)(uint32_t)cqe->user_data;
+    UringChannel * uc = &task->uring->chans[peer];
+
+    if (op == URING_READ) {
+        Channel * ch = &task->channels[peer];
+        uc->reading = 0;
+        if (cqe->res > 0) {
+            // frames may have been taken from the buffer meanwhile
+            memmove(ch->in + ch->in_len, ch->in + uc->read_off, cqe->res);
+            ch->in_len += cqe->res;
+        }
+        else if (cqe->res == 0 || (cqe->res != -EINTR && cqe->res != -EAGAIN)) {
+            // all writers are gone, nothing will come from here anymore
+            uc->eof = 1;
+        }
+        return;
+    }
+
+    uc->writing = 0;
+    if (cqe->res > 0) {
+        uc->wbuf_off += cqe->res;
+    }
+    else if (cqe->res != -EINTR && cqe->res != -EAGAIN) {
+        // frames stay queued, the channel is dead for sends
+        uc->error = -cqe->res;
+    }
+}
+
+static void uring_reap(TaskStruct * task)
+{
+    Uring * ring = task->uring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        uring_complete(task, &ring->cqes[head & ring->cq_mask]);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * @return -1 with errno of the write if one to the peer has failed, 0 otherwise
+ */
+static int uring_error(TaskStruct * task, node_id peer)
+{
+    const UringChannel * uc = &task->uring->chans[peer];
+    if (uc->error) {
+        errno = uc->error;
+        return -1;
+    }
+    return 0;
+}
+
+int uring_send(TaskStruct * task, node_id dst, const Message * msg)
+{
+    Channel * ch = &task->channels[dst];
+    if (RC_FAIL(uring_error(task, dst)) ||
+        RC_FAIL(frame_queue(ch, msg, sizeof(MessageHeader) + msg->s_header.s_payload_len))) {
+        return -1;
+    }
+    ch->frames_out++;
+    // same threshold as writev coalescing of the pipe transport
+    if (ch->out_len >= FRAME_BUF_SIZE && RC_FAIL(uring_commit(task))) {
+        return -1;
+    }
+    return uring_error(task, dst);
+}
+
+int uring_log(TaskStruct * task, const char * buf, size_t len)
+{
+    if (RC_FAIL(uring_error(task, task->total_proc))) {
+        return -1;
+    }
+    return frame_queue(&task->uring->log, buf, len);
+}
+
+/**
+ * Submit prepared requests without waiting
+ */
+int uring_commit(TaskStruct * task)
+{
+    uring_arm(task);
+    if (task->uring->to_submit == 0) {
+        return 0;
+    }
+    if (RC_FAIL(uring_enter(task, 0))) {
+        return -1;
+    }
+    uring_reap(task);
+    return 0;
+}
+
+/**
+ * Pick up whatever has completed, for nonblocking receive
+ */
+int uring_poll(TaskStruct * task)
+{
+    uring_arm(task);
+    if (RC_FAIL(uring_enter(task, 0))) {
+        return -1;
+    }
+    uring_reap(task);
+    return 0;
+}
+
+/**
+ * Wait until some channel has a whole frame at its head
+ *
+ * @return peer of that channel or -1 on error
+ */
+node_id uring_wait_frame(TaskStruct * task)
+{
+    Uring * ring = task->uring;
+    int n = task->total_proc;
+    while (1) {
+        // start where the previous call stopped to serve senders in turn
+        for (int i = 0; i < n; i++) {
+            node_id peer = (ring->next + i) % n;
+            if (peer != task->local_pid && frame_ready(&task->channels[peer])) {
+                ring->next = (peer + 1) % n;
+                return peer;
+            }
+        }
+
+        stats_empty_poll();
+        uring_arm(task);
+        if (RC_FAIL(uring_enter(task, 1))) {
+            return -1;
+        }
+        uring_reap(task);
+    }
+}
+
+static int uring_pending(TaskStruct * task)
+{
+    Uring * ring = task->uring;
+    for (node_id peer = 0; peer <= task->total_proc; peer++) {
+        if (peer == task->local_pid) {
+            continue;
+        }
+        const Channel * ch = (peer == task->total_proc) ? &ring->log : &task->channels[peer];
+        const UringChannel * uc = &ring->chans[peer];
+        if (uc->writing || (!uc->error && (uc->wbuf_off < uc->wbuf_len || ch->out_len > 0))) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Block until all queued frames and log lines are written
+ *
+ * @return 0 on success, -1 with errno of the first failed write
+ */
+int uring_flush(TaskStruct * task)
+{
+    while (1) {
+        uring_arm(task);
+        if (!uring_pending(task)) {
+            for (node_id peer = 0; peer <= task->total_proc; peer++) {
+                if (peer != task->local_pid && RC_FAIL(uring_error(task, peer))) {
+                    return -1;
+                }
+            }
+            return 0;
+        }
+        if (RC_FAIL(uring_enter(task, 1))) {
+            return -1;
+        }
+        uring_reap(task);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "proc.h"
+
+/// Written by the manager once histories are in
+#define WORKLOAD_FILE "workload.log"
+
+/** Parse -W spec, see workload.c
+ *
+ * @return workload or NULL on a bad spec
+ */
+Workload * workload_parse(const char * spec);
+
+/** Take starting balances of the departments, as given on the command line
+ *
+ * @return 0 on success, -1 on error or if there is no money to move
+ */
+int workload_balances(Workload * w, char ** balances, int departments);
+
+/** Issue the first burst in place of bank_robbery
+ *
+ * @return 0 on success, -1 on error
+ */
+int workload_start(TaskStruct * task);
+
+/** Note the ACK of the transfer in flight */
+void workload_ack(TaskStruct * task);
+
+/** Note the time a department sent its history at, the time of its last state */
+void workload_history(TaskStruct * task, timestamp_ext_t time);
+
+/** Issue the next burst once the previous one is through
+ *
+ * @return number of transfers issued, 0 when the workload is over
+ */
+int workload_next(TaskStruct * task);
+
+/** Write WORKLOAD_FILE
+ *
+ * @return 0 on success, 1 if some history is truncated, -1 on error
+ */
+int workload_finish(TaskStruct * task);
+#endif
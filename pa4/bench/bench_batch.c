@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "pipes.h"
+#include "proc.h"
+
+/* Fan-in throughput of receive_any vs receive_batch
+ *
+ * Parent forks N senders that stream small messages to it as fast
+ * as they can. Parent drains them either one message per call
+ * or a batch per call, and the same run is repeated for both modes
+ * on a fresh set of channels.
+ */
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sender(TaskStruct * this, int count)
+{
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    msg.s_header.s_type = TRANSFER;
+    msg.s_header.s_payload_len = sizeof(int);
+
+    close_redundant_pipes(this);
+    for (int i = 0; i < count; i++) {
+        memcpy(msg.s_payload, &i, sizeof(i));
+        if (RC_FAIL(send(this, PARENT_ID, &msg))) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    send_flush(this);
+    exit(EXIT_SUCCESS);
+}
+
+static void run(int nodes, int count, int transport, int batch)
+{
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (node_id i = 1; i < task.total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = task;
+            this.local_pid = i;
+            sender(&this, count);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(&task);
+
+    long total = (long)nodes * count;
+    long received = 0;
+    long calls = 0;
+    Message out[RECEIVE_BATCH_SIZE];
+    node_id from[RECEIVE_BATCH_SIZE];
+
+    long long start = now_ns();
+    while (received < total) {
+        int n = batch ? receive_batch(&task, out, from, RECEIVE_BATCH_SIZE)
+                      : (receive_any(&task, out) < 0 ? -1 : 1);
+        if (n < 0) {
+            fprintf(stderr, "receive failed after %ld messages\n", received);
+            exit(EXIT_FAILURE);
+        }
+        received += n;
+        calls++;
+    }
+    long long elapsed = now_ns() - start;
+
+    for (int i = 0; i < nodes; i++) {
+        wait(NULL);
+    }
+    close(task.pipe_log_fd);
+
+    printf("%-13s %10.0f msg/s, %6.2f msg/call\n",
+           batch ? "receive_batch" : "receive_any",
+           total / (elapsed / 1e9),
+           (double)received / calls);
+}
+
+int main(int argc, char * argv[])
+{
+    int nodes = 4;
+    int count = 100000;
+    int transport = TRANSPORT_PIPE;
+    const char * transport_name = "pipe";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:t:")) != -1) {
+        switch (opt) {
+        case 'p':
+            nodes = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            transport_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s [-p senders] [-n messages per sender] [-t pipe|shm|inbox|uring|seqpacket]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("senders %d, messages %d each, transport %s\n", nodes, count, transport_name);
+    run(nodes, count, transport, 0);
+    run(nodes, count, transport, 1);
+    return 0;
+}
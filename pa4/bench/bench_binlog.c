@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "ipc.h"
+#include "pipes.h"
+#include "proc.h"
+
+/* Cost of pipe_log per message, text against binary records
+ *
+ * Logs M messages of the mutex lab mix (REQUEST, REPLY, RELEASE)
+ * to a file in a temporary directory and reports nanoseconds per
+ * message, flushes of the binary ring included.
+ */
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double run(TaskStruct * task, int count)
+{
+    static const MessageType types[] = {CS_REQUEST, CS_REPLY, CS_RELEASE};
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+
+    long long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        msg.s_header.s_type = types[i % 3];
+        msg.s_header.s_local_time = i;
+        if (RC_FAIL(pipe_log(task, 1 + i % 8, &msg, i & 1))) {
+            perror("pipe_log error");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (task->binlog && RC_FAIL(binlog_flush())) {
+        exit(EXIT_FAILURE);
+    }
+    return (double)(now_ns() - start) / count;
+}
+
+int main(int argc, char * argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 1000000;
+    char path[] = "/tmp/bench_binlog.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || count <= 0) {
+        fprintf(stderr, "%s [messages]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+
+    TaskStruct task = {0};
+    task.total_proc = 9;
+    task.local_pid = PARENT_ID;
+    task.pipe_log_fd = fd;
+
+    double text = run(&task, count);
+    task.binlog = 1;
+    double binary = run(&task, count);
+
+    printf("messages %d\n", count);
+    printf("text   %8.1f ns/msg\n", text);
+    printf("binary %8.1f ns/msg\n", binary);
+    close(fd);
+    return EXIT_SUCCESS;
+}
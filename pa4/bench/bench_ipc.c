@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "pipes.h"
+#include "proc.h"
+#include "stats.h"
+
+/* Ping-pong, streaming and multicast over the real ipc layer
+ *
+ *    bench_ipc [-p nodes] [-n iterations] [-c stream count] [-l]
+ *              [-t pipe,shm,...] [-r any,batch,view] [-m flat,tree]
+ *
+ * Parent forks N nodes over pipe_init and measures, for every
+ * combination of transport, receive mode and multicast mode given:
+ *
+ * - ping-pong: round trip to node 1 and back for payload sizes
+ *   from 0 to MAX_PAYLOAD_LEN, or what the transport takes at most
+ * - stream: node 1 sends a run of messages of each size one way,
+ *   parent takes the rate from asking for the run to the last one,
+ *   and syscalls per message made by all processes meanwhile, as
+ *   counted in the stats pages of stats.c
+ * - fan-out: parent multicasts an empty message, every node answers
+ *   with the time it got it, fan-out is the latest of them
+ *
+ * Nodes receive the same way the parent does, so a mode covers both
+ * ends. A transport plugs in through transport_parse, a receive
+ * mode through receive_modes below. Every combination runs in a
+ * process of its own, transports keep descriptors and mappings until
+ * exit. Results go to stdout as JSON, one object per combination.
+ */
+
+enum {
+    WARMUP = 100 ///< untimed rounds before each measurement
+};
+
+typedef struct {
+    const char * name;
+    const Message * (*next)(TaskStruct * task, node_id * from);
+} ReceiveMode;
+
+typedef struct {
+    int count;
+    int size;
+} StreamOrder;
+
+static const int sizes[] = {0, 16, 64, 256, 1024, MAX_PAYLOAD_LEN};
+
+#define SIZES (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+/**
+ * @return payload size the transport takes at most
+ */
+static int max_payload(TaskStruct * task)
+{
+    if (task->transport == TRANSPORT_INBOX) {
+        // frame with sender id goes in one atomic write
+        return PIPE_BUF - sizeof(node_id) - sizeof(MessageHeader);
+    }
+    return MAX_PAYLOAD_LEN;
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const Message * next_any(TaskStruct * task, node_id * from)
+{
+    static Message msg;
+    *from = receive_any(task, &msg);
+    return (*from < 0) ? NULL : &msg;
+}
+
+static const Message * next_batch(TaskStruct * task, node_id * from)
+{
+    return receive_next(task, from);
+}
+
+static const Message * next_view(TaskStruct * task, node_id * from)
+{
+    // the next view releases this one
+    return receive_view(task, from);
+}
+
+static const ReceiveMode receive_modes[] = {
+    {"any", next_any},
+    {"batch", next_batch},
+    {"view", next_view}
+};
+
+static const ReceiveMode * receive_mode_parse(const char * name)
+{
+    for (size_t i = 0; i < sizeof(receive_modes) / sizeof(receive_modes[0]); i++) {
+        if (strcmp(name, receive_modes[i].name) == 0) {
+            return &receive_modes[i];
+        }
+    }
+    return NULL;
+}
+
+static Message message(MessageType type, int size)
+{
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    msg.s_header.s_type = type;
+    msg.s_header.s_payload_len = size;
+    return msg;
+}
+
+static void node(TaskStruct * this, const ReceiveMode * mode)
+{
+    close_redundant_pipes(this);
+
+    for (;;) {
+        node_id from;
+        const Message * in = mode->next(this, &from);
+        if (in == NULL) {
+            exit(EXIT_FAILURE);
+        }
+
+        switch (in->s_header.s_type) {
+        case STARTED:
+            // ping, goes back as it came
+            if (RC_FAIL(send_to(this, PARENT_ID, in))) {
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case TRANSFER: {
+            StreamOrder order;
+            memcpy(&order, in->s_payload, sizeof(order));
+            Message msg = message(TRANSFER, order.size);
+            for (int i = 0; i < order.count; i++) {
+                if (RC_FAIL(send_to(this, PARENT_ID, &msg))) {
+                    exit(EXIT_FAILURE);
+                }
+            }
+        } break;
+        case CS_REQUEST: {
+            long long now = now_ns();
+            Message reply = message(ACK, sizeof(now));
+            memcpy(reply.s_payload, &now, sizeof(now));
+            if (RC_FAIL(send_to(this, PARENT_ID, &reply))) {
+                exit(EXIT_FAILURE);
+            }
+        } break;
+        case STOP:
+            send_flush(this);
+            exit(EXIT_SUCCESS);
+        default:
+            break;
+        }
+    }
+}
+
+static const Message * expect(TaskStruct * task, const ReceiveMode * mode, MessageType type)
+{
+    node_id from;
+    const Message * in = mode->next(task, &from);
+    if (in == NULL || in->s_header.s_type != type) {
+        fprintf(stderr, "receive failed, %s\n", in == NULL ? "no message" : "unexpected type");
+        exit(EXIT_FAILURE);
+    }
+    return in;
+}
+
+static int compare_ns(const void * a, const void * b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+/** Print mean, min and percentiles of the samples, sorting them */
+static void print_samples(long long * samples, int count)
+{
+    qsort(samples, count, sizeof(long long), compare_ns);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    printf("\"mean_ns\": %.0f, \"min_ns\": %lld, \"p50_ns\": %lld, \"p99_ns\": %lld, \"max_ns\": %lld",
+           sum / count, samples[0], samples[count / 2], samples[(int)(count * 0.99)], samples[count - 1]);
+}
+
+static void pingpong(TaskStruct * task, const ReceiveMode * mode, int iterations, long long * samples)
+{
+    printf("      \"pingpong\": [\n");
+    for (int s = 0; s < SIZES; s++) {
+        int size = (sizes[s] < max_payload(task)) ? sizes[s] : max_payload(task);
+        Message msg = message(STARTED, size);
+        for (int i = -WARMUP; i < iterations; i++) {
+            long long start = now_ns();
+            if (RC_FAIL(send_to(task, 1, &msg))) {
+                perror("send failed");
+                exit(EXIT_FAILURE);
+            }
+            (void)expect(task, mode, STARTED);
+            if (i >= 0) {
+                samples[i] = now_ns() - start;
+            }
+        }
+        printf("        {\"size\": %d, ", size);
+        print_samples(samples, iterations);
+        printf("}%s\n", (s + 1 < SIZES) ? "," : "");
+    }
+    printf("      ],\n");
+}
+
+/**
+ * @return syscalls made by the transport in all processes so far
+ */
+static uint64_t syscalls(TaskStruct * task)
+{
+    uint64_t total = 0;
+    for (node_id id = 0; id < task->total_proc; id++) {
+        total += stats_page_of(task->stats, id)->syscalls;
+    }
+    return total;
+}
+
+static void stream(TaskStruct * task, const ReceiveMode * mode, int count)
+{
+    printf("      \"stream\": [\n");
+    for (int s = 0; s < SIZES; s++) {
+        int size = (sizes[s] < max_payload(task)) ? sizes[s] : max_payload(task);
+        StreamOrder order = {count, size};
+        Message msg = message(TRANSFER, sizeof(order));
+        memcpy(msg.s_payload, &order, sizeof(order));
+
+        uint64_t calls = syscalls(task);
+        long long start = now_ns();
+        if (RC_FAIL(send_to(task, 1, &msg))) {
+            perror("send failed");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++) {
+            (void)expect(task, mode, TRANSFER);
+        }
+        double seconds = (now_ns() - start) / 1e9;
+        calls = syscalls(task) - calls;
+
+        double bytes = (double)count * (sizeof(MessageHeader) + size);
+        printf("        {\"size\": %d, \"count\": %d, \"msg_per_s\": %.0f, \"mb_per_s\": %.1f, \"syscalls_per_msg\": %.3f}%s\n",
+               size, count, count / seconds, bytes / seconds / (1 << 20), (double)calls / count, (s + 1 < SIZES) ? "," : "");
+    }
+    printf("      ],\n");
+}
+
+static void fanout(TaskStruct * task, const ReceiveMode * mode, int iterations, long long * samples)
+{
+    int nodes = task->total_proc - 1;
+    Message msg = message(CS_REQUEST, 0);
+    for (int i = -WARMUP; i < iterations; i++) {
+        long long start = now_ns();
+        if (RC_FAIL(send_multicast(task, &msg))) {
+            perror("multicast failed");
+            exit(EXIT_FAILURE);
+        }
+        long long last = start;
+        for (int n = 0; n < nodes; n++) {
+            long long got;
+            memcpy(&got, expect(task, mode, ACK)->s_payload, sizeof(got));
+            last = (got > last) ? got : last;
+        }
+        if (i >= 0) {
+            samples[i] = last - start;
+        }
+    }
+    printf("      \"fanout\": {\"receivers\": %d, ", nodes);
+    print_samples(samples, iterations);
+    printf("}\n");
+}
+
+static void run(int nodes, int iterations, int count, int lazy,
+                const char * transport, const ReceiveMode * mode, const char * multicast)
+{
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport_parse(transport);
+    task.multicast = multicast_parse(multicast);
+    task.lazy = lazy;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    // counters come from a stats file of our own, gone once mapped
+    char dir[] = "/tmp/bench_ipc.XXXXXX";
+    if (mkdtemp(dir) == NULL || RC_FAIL(chdir(dir)) || RC_FAIL(stats_init(&task))) {
+        perror("stats init failed");
+        exit(EXIT_FAILURE);
+    }
+    unlink(STATS_FILE);
+    rmdir(dir);
+
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (node_id i = 1; i < task.total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = task;
+            this.local_pid = i;
+            node(&this, mode);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(&task);
+
+    long long * samples = malloc(sizeof(long long) * iterations);
+    if (samples == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("      \"transport\": \"%s\", \"receive\": \"%s\", \"multicast\": \"%s\",\n",
+           transport, mode->name, multicast);
+    pingpong(&task, mode, iterations, samples);
+    stream(&task, mode, count);
+    fanout(&task, mode, iterations, samples);
+
+    Message stop = message(STOP, 0);
+    send_multicast(&task, &stop);
+    send_flush(&task);
+    int failed = 0;
+    for (int i = 0; i < nodes; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed++;
+        }
+    }
+    free(samples);
+    close(task.pipe_log_fd);
+
+    if (failed) {
+        fprintf(stderr, "%d nodes failed on %s/%s/%s\n", failed, transport, mode->name, multicast);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/** Split a comma separated list in place
+ *
+ * @return number of items, at most max
+ */
+static int split(char * list, char ** items, int max)
+{
+    int n = 0;
+    for (char * item = strtok(list, ","); item != NULL && n < max; item = strtok(NULL, ",")) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+int main(int argc, char * argv[])
+{
+    int nodes = 4;
+    int iterations = 2000;
+    int count = 20000;
+    int lazy = 0;
+    char transport_list[256] = "pipe,shm,inbox,uring,seqpacket";
+    char receive_list[256] = "any,batch,view";
+    char multicast_list[256] = "flat";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:c:t:r:m:l")) != -1) {
+        switch (opt) {
+        case 'p':
+            nodes = atoi(optarg);
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'c':
+            count = atoi(optarg);
+            break;
+        case 't':
+            snprintf(transport_list, sizeof(transport_list), "%s", optarg);
+            break;
+        case 'r':
+            snprintf(receive_list, sizeof(receive_list), "%s", optarg);
+            break;
+        case 'm':
+            snprintf(multicast_list, sizeof(multicast_list), "%s", optarg);
+            break;
+        case 'l':
+            lazy = 1;
+            break;
+        default:
+            fprintf(stderr, "%s [-p nodes] [-n iterations] [-c stream count] [-l]"
+                    " [-t pipe,shm,inbox,uring,seqpacket] [-r any,batch,view] [-m flat,tree]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nodes < 1 || nodes > MAX_NODE_ID || iterations < 1 || count < 1) {
+        fprintf(stderr, "nodes must be in [1, %d], iterations and count positive\n", MAX_NODE_ID);
+        exit(EXIT_FAILURE);
+    }
+
+    char * transports[16];
+    char * receives[16];
+    char * multicasts[16];
+    int transport_count = split(transport_list, transports, 16);
+    int receive_count = split(receive_list, receives, 16);
+    int multicast_count = split(multicast_list, multicasts, 16);
+    for (int t = 0; t < transport_count; t++) {
+        if (transport_parse(transports[t]) < 0) {
+            fprintf(stderr, "Unknown transport %s\n", transports[t]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int r = 0; r < receive_count; r++) {
+        if (receive_mode_parse(receives[r]) == NULL) {
+            fprintf(stderr, "Unknown receive mode %s\n", receives[r]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int m = 0; m < multicast_count; m++) {
+        if (multicast_parse(multicasts[m]) < 0) {
+            fprintf(stderr, "Unknown multicast %s\n", multicasts[m]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("{\n  \"bench\": \"ipc\", \"nodes\": %d, \"iterations\": %d, \"stream_count\": %d, \"lazy\": %s,\n",
+           nodes, iterations, count, lazy ? "true" : "false");
+    printf("  \"runs\": [\n");
+    int runs = transport_count * receive_count * multicast_count;
+    int done = 0;
+    for (int t = 0; t < transport_count; t++) {
+        for (int r = 0; r < receive_count; r++) {
+            for (int m = 0; m < multicast_count; m++) {
+                printf("    {\n");
+                fflush(stdout);
+                pid_t runner = fork();
+                if (runner == 0) {
+                    run(nodes, iterations, count, lazy, transports[t], receive_mode_parse(receives[r]), multicasts[m]);
+                    exit(EXIT_SUCCESS);
+                }
+                int status;
+                if (runner < 0 || waitpid(runner, &status, 0) < 0 ||
+                    !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                    fprintf(stderr, "run %s/%s/%s failed\n", transports[t], receives[r], multicasts[m]);
+                    exit(EXIT_FAILURE);
+                }
+                printf("    }%s\n", (++done < runs) ? "," : "");
+            }
+        }
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "mutex.h"
+#include "pa2345.h"
+#include "pipes.h"
+#include "proc.h"
+#include "stats.h"
+
+/* request_cs / release_cs under load
+ *
+ *    bench_mutex [-p nodes,...] [-a none,lamport] [-e entries] [-h hold us]
+ *                [-w think us] [-k contenders] [-b burst] [-t transport]
+ *
+ * Parent forks N nodes that sync on STARTED like the lab does, then
+ * the first K of them (all by default) enter the critical section E
+ * times each: think, request_cs, hold, release_cs. Think comes once
+ * per burst of B entries, so -b trades a steady stream for bursts;
+ * -k leaves the rest of the nodes serving requests only, a hot set of
+ * contenders. Hold and think sleep and serve nothing, as the lab
+ * doesn't either, so a long think delays replies to peers as well.
+ *
+ * Report for every N and algorithm, as JSON on stdout:
+ * - entries per second from the first node starting to the last one
+ *   through,
+ * - acquire latency, request_cs call to return, over all entries,
+ * - CS_REQUEST, CS_REPLY and CS_RELEASE sent per entry, counted by
+ *   the stats pages of stats.c.
+ *
+ * An algorithm is an entry of algorithms below: "none" takes no lock
+ * and shows the cost of the harness, "lamport" is --mutexl.
+ */
+
+typedef struct {
+    const char * name;
+    int locking; ///< TaskStruct.locking that switches the algorithm on
+} MutexAlgorithm;
+
+static const MutexAlgorithm algorithms[] = {
+    {"none", 0},
+    {"lamport", 1}
+};
+
+typedef struct {
+    int entries;
+    int hold_us;
+    int think_us;
+    int contenders;
+    int burst;
+} Workload;
+
+/// Shared by the nodes of a run, filled before they exit
+typedef struct {
+    long long start;
+    long long end;
+    long long samples[]; ///< acquire latency of every entry, ns
+} NodeResult;
+
+int trace_printf(TaskStruct * task, const char * file, int line, const char * fmt, ...)
+{
+    va_list argp;
+    va_start(argp, fmt);
+    fprintf(stderr, "%s[%d]: ", file, line);
+    vfprintf(stderr, fmt, argp);
+    va_end(argp);
+    return 0;
+}
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_us(int us)
+{
+    if (us > 0) {
+        struct timespec delay = {us / 1000000, (us % 1000000) * 1000L};
+        nanosleep(&delay, NULL);
+    }
+}
+
+static NodeResult * result_of(void * results, int entries, node_id id)
+{
+    return (NodeResult *)((char *)results + (id - 1) * (sizeof(NodeResult) + sizeof(long long) * entries));
+}
+
+/**
+ * Handle a message that came outside request_cs
+ *
+ * @param queueing peers still ask for the section, keep their requests
+ *
+ * @return 0 on success, -1 on error
+ */
+static int serve(TaskStruct * this, const Message * in, node_id from, int queueing)
+{
+    (void)time_cmp_and_set(ext_time(in));
+    (void)time_inc();
+
+    switch (in->s_header.s_type) {
+    case CS_REQUEST: {
+        if (queueing && RC_FAIL(push_item(this, (Item){ext_time(in), from}))) {
+            return -1;
+        }
+        (void)time_inc();
+        Message msg;
+        create_message(&msg, CS_REPLY, NULL);
+        return send_to(this, from, &msg);
+    }
+    case CS_RELEASE:
+        return queueing ? remove_item(this, from) : 0;
+    case DONE:
+        this->done++;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static void node(TaskStruct * this, const Workload * load, void * results)
+{
+    close_redundant_pipes(this);
+    int peers = this->total_proc - 2;
+    NodeResult * result = result_of(results, load->entries, this->local_pid);
+
+    Message msg;
+    create_message(&msg, STARTED, NULL);
+    send_multicast_except_main(this, &msg);
+    for (int started = 0; started < peers;) {
+        node_id from;
+        const Message * in = receive_next(this, &from);
+        if (in == NULL || RC_FAIL(serve(this, in, from, 1))) {
+            exit(EXIT_FAILURE);
+        }
+        started += (in->s_header.s_type == STARTED);
+    }
+
+    result->start = now_ns();
+    if (this->local_pid <= load->contenders) {
+        for (int i = 0; i < load->entries; i++) {
+            if (i % load->burst == 0) {
+                sleep_us(load->think_us);
+            }
+            long long start = now_ns();
+            if (RC_FAIL(request_cs(this))) {
+                exit(EXIT_FAILURE);
+            }
+            result->samples[i] = now_ns() - start;
+            sleep_us(load->hold_us);
+            if (RC_FAIL(release_cs(this))) {
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    result->end = now_ns();
+
+    time_inc();
+    create_message(&msg, DONE, NULL);
+    send_multicast_except_main(this, &msg);
+    while (this->done < peers) {
+        node_id from;
+        const Message * in = receive_next(this, &from);
+        if (in == NULL || RC_FAIL(serve(this, in, from, 0))) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    send_flush(this);
+    exit(EXIT_SUCCESS);
+}
+
+static int compare_ns(const void * a, const void * b)
+{
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void report(const MutexAlgorithm * algorithm, int nodes, const Workload * load,
+                   void * results, void * stats, int failed)
+{
+    int contenders = (load->contenders < nodes) ? load->contenders : nodes;
+    long total = (long)contenders * load->entries;
+    long long * samples = malloc(sizeof(long long) * total);
+    if (samples == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    long long start = 0;
+    long long end = 0;
+    for (node_id id = 1; id <= contenders; id++) {
+        NodeResult * result = result_of(results, load->entries, id);
+        start = (start == 0 || result->start < start) ? result->start : start;
+        end = (result->end > end) ? result->end : end;
+        memcpy(samples + (id - 1) * load->entries, result->samples, sizeof(long long) * load->entries);
+    }
+    qsort(samples, total, sizeof(long long), compare_ns);
+    double sum = 0;
+    for (long i = 0; i < total; i++) {
+        sum += samples[i];
+    }
+
+    uint64_t messages = 0;
+    for (node_id id = 1; id <= nodes; id++) {
+        const StatsPage * page = stats_page_of(stats, id);
+        messages += page->types[CS_REQUEST].sent + page->types[CS_REPLY].sent + page->types[CS_RELEASE].sent;
+    }
+
+    double seconds = (end - start) / 1e9;
+    printf("    {\"algorithm\": \"%s\", \"nodes\": %d, \"contenders\": %d, \"entries\": %ld, \"failed\": %d,\n",
+           algorithm->name, nodes, contenders, total, failed);
+    printf("     \"wall_s\": %.4f, \"cs_per_s\": %.0f, \"msg_per_cs\": %.2f,\n",
+           seconds, total / seconds, (double)messages / total);
+    printf("     \"acquire\": {\"mean_ns\": %.0f, \"min_ns\": %lld, \"p50_ns\": %lld, \"p90_ns\": %lld, \"p99_ns\": %lld, \"max_ns\": %lld}}",
+           sum / total, samples[0], samples[total / 2], samples[(long)(total * 0.9)], samples[(long)(total * 0.99)], samples[total - 1]);
+    free(samples);
+}
+
+static void run(const MutexAlgorithm * algorithm, int nodes, int transport, const Workload * load)
+{
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport;
+    task.locking = algorithm->locking;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    // counters come from a stats file of our own, gone once mapped
+    char dir[] = "/tmp/bench_mutex.XXXXXX";
+    if (mkdtemp(dir) == NULL || RC_FAIL(chdir(dir)) || RC_FAIL(stats_init(&task))) {
+        perror("stats init failed");
+        exit(EXIT_FAILURE);
+    }
+    unlink(STATS_FILE);
+    rmdir(dir);
+
+    size_t size = nodes * (sizeof(NodeResult) + sizeof(long long) * load->entries);
+    void * results = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (node_id i = 1; i < task.total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = task;
+            this.local_pid = i;
+            this.queue_capacity = this.total_proc - 1;
+            this.queue = malloc(sizeof(Item) * this.queue_capacity);
+            node(&this, load, results);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(&task);
+
+    int failed = 0;
+    for (int i = 0; i < nodes; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed++;
+        }
+    }
+    report(algorithm, nodes, load, results, task.stats, failed);
+    fflush(stdout);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+static const MutexAlgorithm * algorithm_parse(const char * name)
+{
+    for (size_t i = 0; i < sizeof(algorithms) / sizeof(algorithms[0]); i++) {
+        if (strcmp(name, algorithms[i].name) == 0) {
+            return &algorithms[i];
+        }
+    }
+    return NULL;
+}
+
+/** Split a comma separated list in place
+ *
+ * @return number of items, at most max
+ */
+static int split(char * list, char ** items, int max)
+{
+    int n = 0;
+    for (char * item = strtok(list, ","); item != NULL && n < max; item = strtok(NULL, ",")) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+int main(int argc, char * argv[])
+{
+    Workload load = {200, 0, 0, MAX_NODE_ID, 1};
+    int transport = TRANSPORT_PIPE;
+    const char * transport_name = "pipe";
+    char node_list[256] = "2,4,8";
+    char algorithm_list[256] = "none,lamport";
+
+    // runs go well beyond 16-bit time, messages carry the whole clock
+    g_ext = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:e:h:w:k:b:t:")) != -1) {
+        switch (opt) {
+        case 'p':
+            snprintf(node_list, sizeof(node_list), "%s", optarg);
+            break;
+        case 'a':
+            snprintf(algorithm_list, sizeof(algorithm_list), "%s", optarg);
+            break;
+        case 'e':
+            load.entries = atoi(optarg);
+            break;
+        case 'h':
+            load.hold_us = atoi(optarg);
+            break;
+        case 'w':
+            load.think_us = atoi(optarg);
+            break;
+        case 'k':
+            load.contenders = atoi(optarg);
+            break;
+        case 'b':
+            load.burst = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            transport_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s [-p nodes,...] [-a none,lamport] [-e entries] [-h hold us] [-w think us]"
+                    " [-k contenders] [-b burst] [-t pipe|shm|inbox|uring|seqpacket]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (load.entries < 1 || load.contenders < 1 || load.burst < 1 || load.hold_us < 0 || load.think_us < 0) {
+        fprintf(stderr, "entries, contenders and burst must be positive, times not negative\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char * node_items[16];
+    char * algorithm_items[16];
+    int node_count = split(node_list, node_items, 16);
+    int algorithm_count = split(algorithm_list, algorithm_items, 16);
+    for (int p = 0; p < node_count; p++) {
+        int nodes = atoi(node_items[p]);
+        if (nodes < 1 || nodes > MAX_NODE_ID) {
+            fprintf(stderr, "nodes must be in [1, %d]\n", MAX_NODE_ID);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int a = 0; a < algorithm_count; a++) {
+        if (algorithm_parse(algorithm_items[a]) == NULL) {
+            fprintf(stderr, "Unknown algorithm %s\n", algorithm_items[a]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("{\n  \"bench\": \"mutex\", \"transport\": \"%s\", \"entries\": %d, \"hold_us\": %d, \"think_us\": %d, \"burst\": %d,\n",
+           transport_name, load.entries, load.hold_us, load.think_us, load.burst);
+    printf("  \"runs\": [\n");
+    int runs = node_count * algorithm_count;
+    int done = 0;
+    for (int p = 0; p < node_count; p++) {
+        for (int a = 0; a < algorithm_count; a++) {
+            // a run of its own, descriptors and mappings go with it
+            fflush(stdout);
+            pid_t runner = fork();
+            if (runner == 0) {
+                run(algorithm_parse(algorithm_items[a]), atoi(node_items[p]), transport, &load);
+            }
+            int status;
+            if (runner < 0 || waitpid(runner, &status, 0) < 0 ||
+                !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                fprintf(stderr, "run %s on %s nodes failed\n", algorithm_items[a], node_items[p]);
+                exit(EXIT_FAILURE);
+            }
+            printf("%s\n", (++done < runs) ? "," : "");
+        }
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Regression runner over the benchmarks
+ *
+ *    bench_regress [-r repeats] [-w warmup] [-c cpus] [-d bench dir]
+ *                  [-l pa3 lab] [-b baseline.json] [-o results.json]
+ *                  [-s slowdown %]
+ *
+ * Every metric below is a number picked out of the output of a
+ * benchmark command. Commands run warmup times untimed and then
+ * repeats times, each in a scratch directory; metrics of the same
+ * command come from the same runs. Per metric the runner takes mean,
+ * standard deviation and 95% confidence interval of the mean.
+ *
+ * With a baseline, written by an earlier -o, every metric is put to
+ * Welch's t-test against it. A change is reported once it is both
+ * significant and at least -s percent (5 by default); a change for
+ * the worse is a SLOWER and makes the exit status 1.
+ *
+ * The run is pinned to the CPUs of -c, or to all but CPU 0, which
+ * takes most interrupts, when there are 3 or more; children of the
+ * benchmarks inherit it. Bank metrics need a pa3 lab built with its
+ * runtime library, given with -l, and are skipped without it.
+ */
+
+enum {
+    MAX_METRICS = 16,
+    MAX_KEYS = 4,
+    MAX_REPEATS = 1000
+};
+
+typedef struct {
+    const char * name;
+    const char * unit;
+    int higher_better;
+    const char * command; ///< run by sh with $BIN and $LAB set
+    const char * file;    ///< read instead of stdout when set
+    const char * keys[MAX_KEYS]; ///< found in order, the value follows the last
+    int field;            ///< number after the last key to take, from 0
+} Metric;
+
+typedef struct {
+    int n;
+    double mean;
+    double stddev;
+} Summary;
+
+#define IPC "$BIN/bench_ipc -t pipe -r any -p 8 -n 2000 -c 5000"
+#define MUTEX "$BIN/bench_mutex -p 4 -a lamport -e 200"
+#define BANK "$LAB -W count=2000,seed=1 -p 5 10 10 10 10 10 > /dev/null"
+
+static const Metric metrics[] = {
+    {"ipc_rtt_0", "ns", 0, IPC, NULL, {"\"pingpong\"", "\"p50_ns\": "}, 0},
+    {"ipc_rtt_1k", "ns", 0, IPC, NULL, {"\"size\": 1024, ", "\"p50_ns\": "}, 0},
+    {"ipc_stream_0", "msg/s", 1, IPC, NULL, {"\"stream\"", "\"msg_per_s\": "}, 0},
+    {"ipc_fanout_8", "ns", 0, IPC, NULL, {"\"fanout\"", "\"p50_ns\": "}, 0},
+    {"startup_64", "us", 0, "$BIN/bench_startup -r 5 64", NULL, {"best us"}, 1},
+    {"mutex_cs_4", "cs/s", 1, MUTEX, NULL, {"\"cs_per_s\": "}, 0},
+    {"mutex_acquire_4", "ns", 0, MUTEX, NULL, {"\"acquire\"", "\"p50_ns\": "}, 0},
+    {"bank_transfers", "tr/s", 1, BANK, "workload.log", {"transfers/s"}, 0},
+    {"bank_ack", "us", 0, BANK, "workload.log", {"\nack ", "p50 "}, 0}
+};
+
+#define METRICS (int)(sizeof(metrics) / sizeof(metrics[0]))
+
+/// Two sided 95% quantiles of Student's t for 1 to 30 degrees of freedom
+static const double t_table[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double t_quantile(double df)
+{
+    if (df < 1) {
+        return t_table[0];
+    }
+    if (df <= 30) {
+        return t_table[(int)df - 1];
+    }
+    return (df <= 60) ? 2.000 : (df <= 120) ? 1.980 : 1.960;
+}
+
+static double half_width(const Summary * s)
+{
+    return (s->n > 1) ? t_quantile(s->n - 1) * s->stddev / sqrt(s->n) : 0;
+}
+
+/**
+ * @return text read to the end, NULL on error
+ */
+static char * read_all(FILE * in)
+{
+    size_t len = 0;
+    size_t cap = 4096;
+    char * text = malloc(cap);
+    size_t n;
+    while (text != NULL && (n = fread(text + len, 1, cap - len - 1, in)) > 0) {
+        len += n;
+        if (len + 1 == cap) {
+            cap *= 2;
+            text = realloc(text, cap);
+        }
+    }
+    if (text != NULL) {
+        text[len] = '\0';
+    }
+    return text;
+}
+
+/**
+ * @return 0 and the number in value, -1 if a key or the number is missing
+ */
+static int extract(const char * text, const char * const * keys, int field, double * value)
+{
+    const char * at = text;
+    for (int i = 0; i < MAX_KEYS && keys[i] != NULL; i++) {
+        if ((at = strstr(at, keys[i])) == NULL) {
+            return -1;
+        }
+        at += strlen(keys[i]);
+    }
+    for (int i = 0; i <= field; i++) {
+        char * end;
+        at += strcspn(at, "-0123456789.");
+        *value = strtod(at, &end);
+        if (end == at) {
+            return -1;
+        }
+        at = end;
+    }
+    return 0;
+}
+
+/**
+ * @return output of the command, or of its file, NULL on failure
+ */
+static char * run_command(const Metric * metric)
+{
+    if (metric->file != NULL) {
+        unlink(metric->file);
+    }
+    FILE * pipe = popen(metric->command, "r");
+    if (pipe == NULL) {
+        return NULL;
+    }
+    char * text = read_all(pipe);
+    int status = pclose(pipe);
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        free(text);
+        return NULL;
+    }
+    if (metric->file != NULL) {
+        free(text);
+        FILE * in = fopen(metric->file, "r");
+        if (in == NULL) {
+            return NULL;
+        }
+        text = read_all(in);
+        fclose(in);
+    }
+    return text;
+}
+
+static int skipped(const Metric * metric)
+{
+    return strstr(metric->command, "$LAB") != NULL && getenv("LAB") == NULL;
+}
+
+/**
+ * @return 0 if every command went well, -1 otherwise
+ */
+static int run_all(int repeats, int warmup, double (*samples)[MAX_REPEATS], int * counts)
+{
+    int rc = 0;
+    for (int round = -warmup; round < repeats; round++) {
+        char * outputs[MAX_METRICS] = {NULL};
+        for (int m = 0; m < METRICS; m++) {
+            if (skipped(&metrics[m])) {
+                continue;
+            }
+            // metrics of the same command share its run
+            int same = -1;
+            for (int prev = 0; prev < m && same < 0; prev++) {
+                if (strcmp(metrics[prev].command, metrics[m].command) == 0 && metrics[prev].file == metrics[m].file) {
+                    same = prev;
+                }
+            }
+            if (same < 0) {
+                fprintf(stderr, "%s %s\n", (round < 0) ? "warmup" : "run", metrics[m].command);
+                outputs[m] = run_command(&metrics[m]);
+            }
+            const char * text = (same < 0) ? outputs[m] : outputs[same];
+
+            double value;
+            if (text == NULL || extract(text, metrics[m].keys, metrics[m].field, &value) < 0) {
+                fprintf(stderr, "%s: no value\n", metrics[m].name);
+                rc = -1;
+                continue;
+            }
+            if (round >= 0) {
+                samples[m][counts[m]++] = value;
+            }
+        }
+        for (int m = 0; m < METRICS; m++) {
+            free(outputs[m]);
+        }
+    }
+    return rc;
+}
+
+static Summary summarize(const double * samples, int n)
+{
+    Summary s = {n, 0, 0};
+    for (int i = 0; i < n; i++) {
+        s.mean += samples[i];
+    }
+    s.mean = (n > 0) ? s.mean / n : 0;
+    for (int i = 0; i < n; i++) {
+        s.stddev += (samples[i] - s.mean) * (samples[i] - s.mean);
+    }
+    s.stddev = (n > 1) ? sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+/**
+ * @return 0 and the summary of the metric in the baseline, -1 if it has none
+ */
+static int baseline_of(const char * text, const Metric * metric, Summary * s)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\": {", metric->name);
+    const char * mean[] = {key, "\"mean\": ", NULL};
+    const char * stddev[] = {key, "\"stddev\": ", NULL};
+    const char * n[] = {key, "\"n\": ", NULL};
+    double count;
+    if (extract(text, mean, 0, &s->mean) < 0 || extract(text, stddev, 0, &s->stddev) < 0 ||
+        extract(text, n, 0, &count) < 0) {
+        return -1;
+    }
+    s->n = (int)count;
+    return 0;
+}
+
+static int save(const char * path, const Summary * summaries)
+{
+    FILE * out = fopen(path, "w");
+    if (out == NULL) {
+        perror("bench_regress: can't write results");
+        return -1;
+    }
+    fprintf(out, "{\n  \"metrics\": {\n");
+    int first = 1;
+    for (int m = 0; m < METRICS; m++) {
+        if (summaries[m].n == 0) {
+            continue;
+        }
+        fprintf(out, "%s    \"%s\": {\"unit\": \"%s\", \"higher_better\": %s, \"mean\": %.3f, \"stddev\": %.3f, \"n\": %d}",
+                first ? "" : ",\n", metrics[m].name, metrics[m].unit, metrics[m].higher_better ? "true" : "false",
+                summaries[m].mean, summaries[m].stddev, summaries[m].n);
+        first = 0;
+    }
+    fprintf(out, "\n  }\n}\n");
+    return (fclose(out) == 0) ? 0 : -1;
+}
+
+/**
+ * Welch's t-test of the current summary against the baseline
+ *
+ * @return 1 if the means differ at 95%, 0 otherwise
+ */
+static int significant(const Summary * base, const Summary * cur)
+{
+    if (base->n < 2 || cur->n < 2) {
+        return 0;
+    }
+    double vb = base->stddev * base->stddev / base->n;
+    double vc = cur->stddev * cur->stddev / cur->n;
+    if (vb + vc == 0) {
+        return base->mean != cur->mean;
+    }
+    double t = fabs(cur->mean - base->mean) / sqrt(vb + vc);
+    double df = (vb + vc) * (vb + vc) / (vb * vb / (base->n - 1) + vc * vc / (cur->n - 1));
+    return t > t_quantile(df);
+}
+
+/**
+ * @return number of metrics that got slower
+ */
+static int report(const Summary * summaries, const char * baseline, double threshold)
+{
+    int slower = 0;
+    printf("%-16s %6s %22s %22s %8s  %s\n", "metric", "unit", "baseline", "current", "change", "verdict");
+    for (int m = 0; m < METRICS; m++) {
+        const Metric * metric = &metrics[m];
+        const Summary * cur = &summaries[m];
+        if (cur->n == 0) {
+            printf("%-16s %6s %22s %22s %8s  %s\n", metric->name, metric->unit, "-", "-", "-",
+                   skipped(metric) ? "skipped" : "failed");
+            continue;
+        }
+
+        char current[32];
+        snprintf(current, sizeof(current), "%.1f +- %.1f", cur->mean, half_width(cur));
+        Summary base;
+        if (baseline == NULL || baseline_of(baseline, metric, &base) < 0) {
+            printf("%-16s %6s %22s %22s %8s  %s\n", metric->name, metric->unit, "-", current, "-", "new");
+            continue;
+        }
+
+        char was[32];
+        snprintf(was, sizeof(was), "%.1f +- %.1f", base.mean, half_width(&base));
+        double change = (base.mean != 0) ? (cur->mean - base.mean) / base.mean * 100 : 0;
+        int worse = metric->higher_better ? cur->mean < base.mean : cur->mean > base.mean;
+        const char * verdict = "same";
+        if (significant(&base, cur) && fabs(change) >= threshold) {
+            verdict = worse ? "SLOWER" : "faster";
+            slower += worse;
+        }
+        printf("%-16s %6s %22s %22s %+7.1f%%  %s\n", metric->name, metric->unit, was, current, change, verdict);
+    }
+    return slower;
+}
+
+/** Pin to the given CPUs, or to all but CPU 0 when there are 3 or more */
+static void pin(const char * cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (cpus != NULL) {
+        char * copy = strdup(cpus);
+        for (char * item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+            CPU_SET(atoi(item), &set);
+        }
+        free(copy);
+    }
+    else {
+        cpu_set_t online;
+        if (sched_getaffinity(0, sizeof(online), &online) < 0 || CPU_COUNT(&online) < 3) {
+            fprintf(stderr, "not pinned, too few CPUs\n");
+            return;
+        }
+        CPU_OR(&set, &set, &online);
+        CPU_CLR(0, &set);
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        fprintf(stderr, "not pinned: %s\n", strerror(errno));
+        return;
+    }
+    fprintf(stderr, "pinned to %d CPUs\n", CPU_COUNT(&set));
+}
+
+int main(int argc, char * argv[])
+{
+    int repeats = 5;
+    int warmup = 1;
+    double threshold = 5;
+    const char * cpus = NULL;
+    const char * dir = ".";
+    const char * lab = NULL;
+    const char * baseline_path = NULL;
+    const char * output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:c:d:l:b:o:s:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repeats = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'c':
+            cpus = optarg;
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'l':
+            lab = optarg;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 's':
+            threshold = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-r repeats] [-w warmup] [-c cpus] [-d bench dir] [-l pa3 lab]"
+                    " [-b baseline.json] [-o results.json] [-s slowdown %%]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (repeats < 1 || repeats > MAX_REPEATS || warmup < 0) {
+        fprintf(stderr, "repeats must be in [1, %d], warmup not negative\n", MAX_REPEATS);
+        return EXIT_FAILURE;
+    }
+
+    char * baseline = NULL;
+    if (baseline_path != NULL) {
+        FILE * in = fopen(baseline_path, "r");
+        if (in == NULL) {
+            fprintf(stderr, "no baseline %s, reporting without it\n", baseline_path);
+        }
+        else {
+            baseline = read_all(in);
+            fclose(in);
+        }
+    }
+
+    // commands run in a scratch directory and find binaries by absolute paths
+    char path[PATH_MAX];
+    if (realpath(dir, path) == NULL || setenv("BIN", path, 1) < 0) {
+        perror("bench_regress: bad bench dir");
+        return EXIT_FAILURE;
+    }
+    if (lab != NULL && (realpath(lab, path) == NULL || setenv("LAB", path, 1) < 0)) {
+        perror("bench_regress: bad lab");
+        return EXIT_FAILURE;
+    }
+    char results[PATH_MAX] = "";
+    if (output != NULL && output[0] != '/' && getcwd(results, sizeof(results) - 1) != NULL) {
+        strcat(results, "/");
+    }
+    if (output != NULL) {
+        strncat(results, output, sizeof(results) - strlen(results) - 1);
+    }
+    char scratch[] = "/tmp/bench_regress.XXXXXX";
+    if (mkdtemp(scratch) == NULL || chdir(scratch) < 0) {
+        perror("bench_regress: no scratch directory");
+        return EXIT_FAILURE;
+    }
+    pin(cpus);
+
+    static double samples[MAX_METRICS][MAX_REPEATS];
+    int counts[MAX_METRICS] = {0};
+    int rc = run_all(repeats, warmup, samples, counts);
+
+    Summary summaries[MAX_METRICS];
+    for (int m = 0; m < METRICS; m++) {
+        summaries[m] = summarize(samples[m], counts[m]);
+    }
+    int slower = report(summaries, baseline, threshold);
+    if (output != NULL && save(results, summaries) < 0) {
+        rc = -1;
+    }
+
+    char remove[PATH_MAX];
+    snprintf(remove, sizeof(remove), "rm -rf %s", scratch);
+    if (chdir("/") < 0 || system(remove) != 0) {
+        rc = -1;
+    }
+    return (slower > 0 || rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "pipes.h"
+#include "proc.h"
+
+/* All-to-all request/reply rounds with extended ids and time
+ *
+ * Every node multicasts a request stamped with its 64-bit Lamport
+ * clock to the other nodes and waits for their replies, R times,
+ * answering requests of others all along, like the mutex lab does
+ * with --mutexl. A node that is through multicasts DONE and keeps
+ * answering until DONE of everybody else is in.
+ *
+ * Parent reports wall time of the whole run, message rate and
+ * descriptors held by a node, which is what limits N in practice.
+ */
+
+static timestamp_ext_t clock_now;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int count_fds()
+{
+    DIR * dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return -1;
+    }
+    int n = 0;
+    while (readdir(dir) != NULL) {
+        n++;
+    }
+    closedir(dir);
+    return n - 3; ///< ".", ".." and the directory itself
+}
+
+static Message stamped(MessageType type)
+{
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    msg.s_header.s_type = type;
+    (void)ext_wrap(&msg, ++clock_now, &msg);
+    return msg;
+}
+
+static int multicast_nodes(TaskStruct * this, const Message * msg)
+{
+    for (node_id dst = 1; dst < this->total_proc; dst++) {
+        if (dst != this->local_pid && RC_FAIL(send_to(this, dst, msg))) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void node(TaskStruct * this, int rounds, int * fds_pipe)
+{
+    close_redundant_pipes(this);
+    if (this->local_pid == 1) {
+        int fds = count_fds();
+        write(fds_pipe[1], &fds, sizeof(fds));
+    }
+    close(fds_pipe[1]);
+
+    int peers = this->total_proc - 2;
+    int round = 0;
+    int replies = 0;
+    int done = 0;
+
+    Message msg = stamped(CS_REQUEST);
+    if (peers == 0 || RC_FAIL(multicast_nodes(this, &msg))) {
+        exit(peers == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    while (round < rounds || done < peers) {
+        node_id from;
+        const Message * in = receive_next(this, &from);
+        if (in == NULL) {
+            exit(EXIT_FAILURE);
+        }
+        timestamp_ext_t time = ext_time(in);
+        clock_now = (time > clock_now) ? time : clock_now;
+
+        switch (in->s_header.s_type) {
+        case CS_REQUEST:
+            msg = stamped(CS_REPLY);
+            send_to(this, from, &msg);
+            break;
+        case CS_REPLY:
+            if (++replies < peers) {
+                break;
+            }
+            replies = 0;
+            msg = stamped((++round < rounds) ? CS_REQUEST : DONE);
+            if (msg.s_header.s_type == CS_REQUEST) {
+                multicast_nodes(this, &msg);
+            }
+            else {
+                send_multicast(this, &msg);
+            }
+            break;
+        case DONE:
+            done++;
+            break;
+        default:
+            break;
+        }
+    }
+
+    send_flush(this);
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char * argv[])
+{
+    int nodes = 64;
+    int rounds = 10;
+    int transport = TRANSPORT_INBOX;
+    const char * transport_name = "inbox";
+    int lazy = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:r:t:l")) != -1) {
+        switch (opt) {
+        case 'p':
+            nodes = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            transport_name = optarg;
+            break;
+        case 'l':
+            lazy = 1;
+            break;
+        default:
+            fprintf(stderr, "%s [-p nodes] [-r rounds] [-t pipe|shm|inbox|uring|seqpacket] [-l]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nodes < 1 || nodes > MAX_NODE_ID) {
+        fprintf(stderr, "nodes must be in [1, %d]\n", MAX_NODE_ID);
+        exit(EXIT_FAILURE);
+    }
+
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport;
+    task.lazy = lazy;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    long long start = now_ns();
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    int fds_pipe[2];
+    if (RC_FAIL(pipe(fds_pipe))) {
+        perror("pipe error");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (node_id i = 1; i < task.total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = task;
+            this.local_pid = i;
+            node(&this, rounds, fds_pipe);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(&task);
+    close(fds_pipe[1]);
+
+    // DONE of every node, requests and replies never come here
+    int done = 0;
+    while (done < nodes) {
+        node_id from;
+        const Message * in = receive_next(&task, &from);
+        if (in == NULL) {
+            fprintf(stderr, "receive failed after %d DONE\n", done);
+            exit(EXIT_FAILURE);
+        }
+        done += (in->s_header.s_type == DONE);
+    }
+    send_flush(&task);
+    long long elapsed = now_ns() - start;
+
+    int failed = 0;
+    for (int i = 0; i < nodes; i++) {
+        int status;
+        if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+            failed++;
+        }
+    }
+    int fds = -1;
+    if (read(fds_pipe[0], &fds, sizeof(fds)) != sizeof(fds)) {
+        fds = -1;
+    }
+
+    // request and reply per pair of nodes per round, DONE to everybody
+    double messages = 2.0 * nodes * (nodes - 1) * rounds + (double)nodes * nodes;
+    printf("nodes %d, rounds %d, transport %s%s\n", nodes, rounds, transport_name, lazy ? " (lazy)" : "");
+    printf("wall %.3f s, %.0f msg/s, %d fds per node after setup, %d failed\n",
+           elapsed / 1e9, messages / (elapsed / 1e9), fds, failed);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "pipes.h"
+#include "proc.h"
+
+/* Small control messages over the pipe mesh vs seqpacket sockets
+ *
+ * Messages are empty, like CS_REQUEST / CS_REPLY / CS_RELEASE of
+ * the mutex lab, so the cost is all in syscalls and framing.
+ *
+ * - ping-pong: parent sends a request to one node at a time
+ *   and waits for the reply, round trip per message
+ * - fan-in: N nodes stream requests to the parent, which drains
+ *   them with receive_any and then with receive_batch
+ */
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static Message control(MessageType type)
+{
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    msg.s_header.s_type = type;
+    msg.s_header.s_payload_len = 0;
+    return msg;
+}
+
+static void echo(TaskStruct * this)
+{
+    Message msg;
+    while (receive_any(this, &msg) >= 0 && msg.s_header.s_type != STOP) {
+        Message reply = control(CS_REPLY);
+        send(this, PARENT_ID, &reply);
+    }
+    send_flush(this);
+}
+
+static void stream(TaskStruct * this, int count)
+{
+    Message msg = control(CS_REQUEST);
+    for (int i = 0; i < count; i++) {
+        if (RC_FAIL(send(this, PARENT_ID, &msg))) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    send_flush(this);
+}
+
+/**
+ * Set up channels for N nodes and fork them running given role
+ */
+static void spawn(TaskStruct * task, int nodes, int transport, int count, int ping)
+{
+    memset(task, 0, sizeof(*task));
+    task->total_proc = nodes + 1;
+    task->local_pid = PARENT_ID;
+    task->transport = transport;
+    task->pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    if (RC_FAIL(pipe_init(task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    for (node_id i = 1; i < task->total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = *task;
+            this.local_pid = i;
+            close_redundant_pipes(&this);
+            if (ping) {
+                echo(&this);
+            }
+            else {
+                stream(&this, count);
+            }
+            exit(EXIT_SUCCESS);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(task);
+}
+
+static void reap(TaskStruct * task, int nodes)
+{
+    for (int i = 0; i < nodes; i++) {
+        wait(NULL);
+    }
+    close(task->pipe_log_fd);
+}
+
+static double ping_pong(int nodes, int transport, int rounds)
+{
+    TaskStruct task;
+    spawn(&task, nodes, transport, 0, 1);
+
+    Message msg = control(CS_REQUEST);
+    Message reply;
+    long long start = now_ns();
+    for (int r = 0; r < rounds; r++) {
+        if (RC_FAIL(send(&task, 1 + r % nodes, &msg)) || receive_any(&task, &reply) < 0) {
+            fprintf(stderr, "ping-pong failed at round %d\n", r);
+            exit(EXIT_FAILURE);
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    msg = control(STOP);
+    send_multicast(&task, &msg);
+    send_flush(&task);
+    reap(&task, nodes);
+    return elapsed / 1e3 / rounds;
+}
+
+static double fan_in(int nodes, int transport, int count, int batch)
+{
+    TaskStruct task;
+    spawn(&task, nodes, transport, count, 0);
+
+    long total = (long)nodes * count;
+    long received = 0;
+    Message out[RECEIVE_BATCH_SIZE];
+    node_id from[RECEIVE_BATCH_SIZE];
+
+    long long start = now_ns();
+    while (received < total) {
+        int n = batch ? receive_batch(&task, out, from, RECEIVE_BATCH_SIZE)
+                      : (receive_any(&task, out) < 0 ? -1 : 1);
+        if (n < 0) {
+            fprintf(stderr, "receive failed after %ld messages\n", received);
+            exit(EXIT_FAILURE);
+        }
+        received += n;
+    }
+    long long elapsed = now_ns() - start;
+
+    reap(&task, nodes);
+    return total / (elapsed / 1e9);
+}
+
+int main(int argc, char * argv[])
+{
+    int nodes = 4;
+    int count = 100000;
+    int rounds = 20000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:r:")) != -1) {
+        switch (opt) {
+        case 'p':
+            nodes = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "%s [-p nodes] [-n messages per node] [-r ping-pong rounds]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    const char * names[] = {"pipe", "seqpacket"};
+    printf("nodes %d, fan-in %d messages each, ping-pong %d rounds\n", nodes, count, rounds);
+    printf("%-10s %12s %16s %16s\n", "transport", "rtt us", "receive_any/s", "receive_batch/s");
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        int transport = transport_parse(names[i]);
+        double rtt = ping_pong(nodes, transport, rounds);
+        double any = fan_in(nodes, transport, count, 0);
+        double batch = fan_in(nodes, transport, count, 1);
+        printf("%-10s %12.2f %16.0f %16.0f\n", names[i], rtt, any, batch);
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "pipes.h"
+#include "proc.h"
+#include "spawn.h"
+
+/* Time to all STARTED
+ *
+ * Clock starts before pipe_init and stops once the parent holds
+ * STARTED of every node, which covers building the mesh, forking
+ * and dropping foreign descriptors in every node. Repeated R times,
+ * median and best run are reported for each N.
+ */
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void * a, const void * b)
+{
+    long long lhs = *(const long long *)a;
+    long long rhs = *(const long long *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void node(TaskStruct * this)
+{
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    msg.s_header.s_type = STARTED;
+
+    if (RC_FAIL(close_redundant_pipes(this)) ||
+        RC_FAIL(send_to(this, PARENT_ID, &msg)) ||
+        RC_FAIL(send_flush(this)) ||
+        receive_any(this, &msg) < 0) {
+        exit(EXIT_FAILURE);
+    }
+    exit(msg.s_header.s_type == STOP ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @return nanoseconds to all STARTED, -1 on error
+ */
+static long long run(int nodes, int transport, int spawn_type)
+{
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport;
+    task.spawn = spawn_type;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    long long start = now_ns();
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        return -1;
+    }
+    fflush(stdout);
+    node_id id = spawn(&task);
+    if (id < 0) {
+        return -1;
+    }
+    if (id != PARENT_ID) {
+        TaskStruct this = task;
+        this.local_pid = id;
+        node(&this);
+    }
+    if (RC_FAIL(close_redundant_pipes(&task))) {
+        return -1;
+    }
+
+    Message msg;
+    for (int started = 0; started < nodes; started++) {
+        if (receive_any(&task, &msg) < 0 || msg.s_header.s_type != STARTED) {
+            fprintf(stderr, "STARTED %d of %d\n", started, nodes);
+            return -1;
+        }
+    }
+    long long elapsed = now_ns() - start;
+
+    msg.s_header.s_type = STOP;
+    send_multicast(&task, &msg);
+    send_flush(&task);
+
+    // tree spawn reparents grandchildren here, wait until none is left
+    int failed = 0;
+    int status;
+    while (wait(&status) > 0) {
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+    }
+    return failed ? -1 : elapsed;
+}
+
+/**
+ * Run in a process of its own, so descriptors and mappings of the
+ * parent are gone afterwards and it becomes the only subreaper
+ */
+static long long run_isolated(int nodes, int transport, int spawn_type)
+{
+    int fds[2];
+    if (RC_FAIL(pipe(fds))) {
+        perror("pipe error");
+        return -1;
+    }
+    fflush(stdout);
+    switch (fork()) {
+    case -1:
+        perror("fork error");
+        return -1;
+    case 0: {
+        close(fds[0]);
+        long long elapsed = run(nodes, transport, spawn_type);
+        write(fds[1], &elapsed, sizeof(elapsed));
+        exit(EXIT_SUCCESS);
+    }
+    default:
+        break;
+    }
+
+    close(fds[1]);
+    long long elapsed = -1;
+    if (read(fds[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+        elapsed = -1;
+    }
+    close(fds[0]);
+    wait(NULL);
+    return elapsed;
+}
+
+int main(int argc, char * argv[])
+{
+    int repeat = 5;
+    int transport = TRANSPORT_PIPE;
+    const char * transport_name = "pipe";
+    int spawn_type = SPAWN_FLAT;
+    const char * spawn_name = "flat";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:t:s:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            transport_name = optarg;
+            break;
+        case 's':
+            if ((spawn_type = spawn_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown spawn %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            spawn_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s [-r repeat] [-t pipe|shm|inbox|uring|seqpacket] [-s flat|tree] N...\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind == argc || repeat <= 0) {
+        fprintf(stderr, "%s [-r repeat] [-t pipe|shm|inbox|uring|seqpacket] [-s flat|tree] N...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    long long * samples = malloc(sizeof(long long) * repeat);
+    printf("transport %s, spawn %s\n", transport_name, spawn_name);
+    printf("%6s %12s %12s\n", "N", "median us", "best us");
+    for (int arg = optind; arg < argc; arg++) {
+        int nodes = atoi(argv[arg]);
+        if (nodes < 1 || nodes > MAX_NODE_ID) {
+            fprintf(stderr, "N must be in [1, %d]\n", MAX_NODE_ID);
+            exit(EXIT_FAILURE);
+        }
+        for (int r = 0; r < repeat; r++) {
+            if ((samples[r] = run_isolated(nodes, transport, spawn_type)) < 0) {
+                fprintf(stderr, "run of %d nodes failed\n", nodes);
+                exit(EXIT_FAILURE);
+            }
+        }
+        qsort(samples, repeat, sizeof(long long), cmp_ll);
+        printf("%6d %12.1f %12.1f\n", nodes, samples[repeat / 2] / 1e3, samples[0] / 1e3);
+    }
+    free(samples);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+#include "pipes.h"
+#include "proc.h"
+
+/* Idle CPU and wakeup latency of receive_any
+ *
+ * Parent forks N nodes over the real pipe mesh, leaves them
+ * blocked in receive_any for a while, then pings them one by one
+ * and measures round trip of a wakeup + echo.
+ * CPU time burnt by every node is taken from wait4 rusage
+ */
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ll(const void * a, const void * b)
+{
+    long long lhs = *(const long long *)a;
+    long long rhs = *(const long long *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+static void node(TaskStruct * this)
+{
+    Message msg;
+
+    close_redundant_pipes(this);
+    while (1) {
+        if (receive_any(this, &msg) < 0) {
+            exit(EXIT_FAILURE);
+        }
+        if (msg.s_header.s_type == STOP) {
+            exit(EXIT_SUCCESS);
+        }
+        msg.s_header.s_type = ACK;
+        send(this, PARENT_ID, &msg);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    int nodes = 4;
+    int idle_ms = 1000;
+    int rounds = 1000;
+    int transport = TRANSPORT_PIPE;
+    const char * transport_name = "pipe";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:i:r:t:")) != -1) {
+        switch (opt) {
+        case 'p':
+            nodes = atoi(optarg);
+            break;
+        case 'i':
+            idle_ms = atoi(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            transport_name = optarg;
+            break;
+        default:
+            fprintf(stderr, "%s [-p nodes] [-i idle ms] [-r rounds] [-t pipe|shm|inbox|uring|seqpacket]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    TaskStruct task = {0};
+    task.total_proc = nodes + 1;
+    task.local_pid = PARENT_ID;
+    task.transport = transport;
+    task.pipe_log_fd = open("/dev/null", O_WRONLY);
+
+    if (RC_FAIL(pipe_init(&task))) {
+        perror("pipe init failed");
+        exit(EXIT_FAILURE);
+    }
+
+    for (node_id i = 1; i < task.total_proc; i++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            exit(EXIT_FAILURE);
+        case 0: {
+            TaskStruct this = task;
+            this.local_pid = i;
+            node(&this);
+        } break;
+        default:
+            break;
+        }
+    }
+    close_redundant_pipes(&task);
+
+    struct timespec idle = {idle_ms / 1000, (idle_ms % 1000) * 1000000L};
+    nanosleep(&idle, NULL);
+
+    Message msg = {{0}};
+    msg.s_header.s_magic = MESSAGE_MAGIC;
+    long long * rtt = malloc(sizeof(long long) * rounds);
+    for (int r = 0; r < rounds; r++) {
+        node_id dst = 1 + r % nodes;
+        msg.s_header.s_type = STARTED;
+        msg.s_header.s_payload_len = 0;
+
+        long long start = now_ns();
+        send(&task, dst, &msg);
+        receive_any(&task, &msg);
+        rtt[r] = now_ns() - start;
+    }
+
+    msg.s_header.s_type = STOP;
+    send_multicast(&task, &msg);
+    send_flush(&task);
+
+    double cpu_ms = 0;
+    for (int i = 0; i < nodes; i++) {
+        struct rusage usage;
+        if (wait4(-1, NULL, 0, &usage) < 0) {
+            perror("wait4 error");
+            exit(EXIT_FAILURE);
+        }
+        cpu_ms += usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3 +
+                  usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+    }
+
+    qsort(rtt, rounds, sizeof(long long), &cmp_ll);
+    long long sum = 0;
+    for (int r = 0; r < rounds; r++) {
+        sum += rtt[r];
+    }
+
+    printf("nodes %d, idle %d ms, rounds %d, transport %s\n", nodes, idle_ms, rounds, transport_name);
+    printf("cpu per node: %.2f ms\n", cpu_ms / nodes);
+    printf("wakeup rtt: avg %.1f us, p50 %.1f us, p99 %.1f us\n",
+           sum / 1e3 / rounds,
+           rtt[rounds / 2] / 1e3,
+           rtt[rounds * 99 / 100] / 1e3);
+
+    free(rtt);
+    return 0;
+}
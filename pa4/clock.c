@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "banking.h"
+#include "clock.h"
+
+#define CLOCK_MAX(x, y) ((x > y) ? x : y)
+
+timestamp_ext_t g_time = 0;
+
+int g_ext = 0;
+
+timestamp_ext_t time_cmp_and_set(timestamp_ext_t time)
+{
+    g_time = CLOCK_MAX(g_time, time);
+    return g_time;
+}
+
+timestamp_ext_t time_inc()
+{
+    return ++g_time;
+}
+
+timestamp_t get_lamport_time()
+{
+    return g_time;
+}
+
+int create_message(Message * msg, MessageType type, const MessagePayload * payload)
+{
+    MessageHeader header;
+    header.s_magic = MESSAGE_MAGIC;
+    header.s_type = type;
+    header.s_local_time = get_lamport_time();
+
+    if (payload == NULL) {
+        msg->s_header = header;
+        msg->s_header.s_payload_len = 0;
+        return g_ext ? ext_wrap(msg, g_time, msg) : 0;
+    }
+
+    if (payload->s_size > MAX_PAYLOAD_LEN) {
+        return 1;
+    }
+    header.s_payload_len = payload->s_size;
+
+    msg->s_header = header;
+    memcpy(msg->s_payload, payload->s_data, payload->s_size);
+    return g_ext ? ext_wrap(msg, g_time, msg) : 0;
+}
@@ -0,0 +1,31 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include "ipc.h"
+#include "ipc_ext.h"
+#include "proc.h"
+
+/* Lamport clock of the process and messages stamped with it
+ *
+ * Shared by the lab and bench_mutex, so mutex.c runs against the
+ * same clock in both. With g_ext set create_message wraps every
+ * message with ExtTrailer, otherwise s_local_time carries the low
+ * bits of the clock only.
+ */
+
+/// wide enough for hundreds of nodes, classic messages carry the low bits
+extern timestamp_ext_t g_time;
+
+/// --ext: stamp messages with the whole clock
+extern int g_ext;
+
+timestamp_ext_t time_cmp_and_set(timestamp_ext_t time);
+
+timestamp_ext_t time_inc();
+
+/** Message of given type with optional payload, stamped with g_time
+ *
+ * @return 0 on success, any non-zero value if the payload doesn't fit
+ */
+int create_message(Message * msg, MessageType type, const MessagePayload * payload);
+#endif
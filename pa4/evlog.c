@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "evlog.h"
+#include "proc.h"
+
+/* Per-process event log segments
+ *
+ * Every process appending to one events.log with O_APPEND contends
+ * on the inode lock, a syscall per event. Instead every process maps
+ * a file of its own, events.<id>.seg, and event is a copy into the
+ * mapping:
+ *
+ *    +-------------+-----------------------+-----------------------+--
+ *    | EvlogHeader | EvlogRecord | text    | EvlogRecord | text    |
+ *    +-------------+-----------------------+-----------------------+--
+ *
+ * used in the header is bumped after the record is complete, so the
+ * file is readable up to it even if the process dies. Segment is
+ * EVLOG_SEGMENT bytes to start with and doubles with ftruncate and
+ * mremap when full, that's the only syscall on the way.
+ *
+ * Time is what the lab orders events by: Lamport time in pa3/pa4,
+ * physical time in pa2. evlog_merge merges segments by
+ * (time, id, seq) into the canonical events.log.
+ */
+
+typedef struct {
+    char * base;
+    size_t size;
+    int fd;
+    node_id self; ///< process the segment belongs to
+    pid_t owner;  ///< same at exit, children inherit the segment of the parent
+    uint32_t seq;
+} Evlog;
+
+static Evlog evlog = {NULL, 0, -1, -1, 0, 0};
+
+static EvlogHeader * evlog_header(void)
+{
+    return (EvlogHeader *)evlog.base;
+}
+
+static void evlog_atexit(void)
+{
+    // trim preallocated tail, the segment is complete
+    if (evlog.base != NULL && evlog.owner == getpid()) {
+        (void)ftruncate(evlog.fd, evlog_header()->used);
+    }
+}
+
+/**
+ * Map a new segment, the one inherited through fork stays with the parent
+ */
+static int evlog_open(node_id self)
+{
+    char path[64];
+    snprintf(path, sizeof(path), EVLOG_FILE_FMT, self);
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, MODE);
+    if (fd < 0 || RC_FAIL(ftruncate(fd, EVLOG_SEGMENT))) {
+        perror("evlog_open error");
+        return -1;
+    }
+    char * base = mmap(NULL, EVLOG_SEGMENT, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        perror("evlog_open mmap error");
+        close(fd);
+        return -1;
+    }
+
+    if (evlog.self < 0 && RC_FAIL(atexit(evlog_atexit))) {
+        return -1;
+    }
+    evlog.base = base;
+    evlog.size = EVLOG_SEGMENT;
+    evlog.fd = fd;
+    evlog.self = self;
+    evlog.owner = getpid();
+    evlog.seq = 0;
+
+    EvlogHeader * header = evlog_header();
+    header->magic = EVLOG_MAGIC;
+    header->self = self;
+    header->used = sizeof(EvlogHeader);
+    return 0;
+}
+
+static int evlog_grow(size_t need)
+{
+    size_t size = evlog.size;
+    while (size < need) {
+        size *= 2;
+    }
+    if (RC_FAIL(ftruncate(evlog.fd, size))) {
+        perror("evlog_grow ftruncate error");
+        return -1;
+    }
+    char * base = mremap(evlog.base, evlog.size, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+        perror("evlog_grow mremap error");
+        return -1;
+    }
+    evlog.base = base;
+    evlog.size = size;
+    return 0;
+}
+
+int evlog_append(node_id self, timestamp_ext_t time, const char * text, int len)
+{
+    if (evlog.self != self && RC_FAIL(evlog_open(self))) {
+        return -1;
+    }
+
+    EvlogHeader * header = evlog_header();
+    size_t size = (sizeof(EvlogRecord) + len + EVLOG_ALIGN - 1) & ~(size_t)(EVLOG_ALIGN - 1);
+    if (header->used + size > evlog.size) {
+        if (RC_FAIL(evlog_grow(header->used + size))) {
+            return -1;
+        }
+        header = evlog_header();
+    }
+
+    EvlogRecord * rec = (EvlogRecord *)(evlog.base + header->used);
+    rec->time = time;
+    rec->seq = evlog.seq++;
+    rec->len = len;
+    rec->self = self;
+    memcpy(rec + 1, text, len);
+    header->used += size;
+    return 0;
+}
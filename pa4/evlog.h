@@ -0,0 +1,35 @@
+#ifndef EVLOG_H_
+#define EVLOG_H_
+
+#include <stdint.h>
+
+#include "ipc.h"
+#include "ipc_ext.h"
+
+/// Segment of process id, evlog_merge makes events.log of them
+#define EVLOG_FILE_FMT "events.%d.seg"
+
+#define EVLOG_MAGIC 0xE10C5E6Du
+
+enum {
+    EVLOG_SEGMENT = 1 << 20, ///< initial size of a segment, doubled when full
+    EVLOG_ALIGN = 8
+};
+
+typedef struct {
+    uint32_t magic;
+    node_id self;
+    uint16_t reserved;
+    uint64_t used; ///< bytes of header and records written so far
+} EvlogHeader;
+
+/// Record header, followed by len bytes of text padded to EVLOG_ALIGN
+typedef struct {
+    timestamp_ext_t time;
+    uint32_t seq;         ///< number of the event in its process
+    uint16_t len;
+    node_id self;
+} EvlogRecord;
+
+int evlog_append(node_id self, timestamp_ext_t time, const char * text, int len);
+#endif
@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "pipes.h"
+#include "stats.h"
+
+/* Channel table and framing over nonblocking pipes
+ *
+ * Every process keeps one Channel per peer in a contiguous array
+ * indexed by node_id: both pipe ends, framing buffers and counters.
+ * It's built from the pipes matrix by close_redundant_pipes, after
+ * which the matrix is freed, so a lookup is a single indexed load
+ * and the process holds O(N) state instead of the whole mesh.
+ * Input buffers of all channels live in one allocation as well.
+ *
+ * Framing
+ *
+ *
+ * Pipe is a byte stream: read() may return half of a frame
+ * or several frames at once, write() may take only part of a frame
+ * or fail with EAGAIN when the pipe is full.
+ *
+ * Every channel keeps an input buffer that is refilled with a single
+ * read() of whatever is available, and whole frames are cut from
+ * its head. Leftover bytes stay for the next call.
+ *
+ * Output is coalesced: frames are queued per channel and go out
+ * together when the sender commits its step (frame_flush) or when
+ * the queue reaches FRAME_BUF_SIZE (frame_write, with one writev).
+ * Whatever the pipe doesn't accept stays queued for the next flush,
+ * so frames are never split by or reordered with other frames.
+ */
+
+int channel_init(TaskStruct * task)
+{
+    node_id n = task->total_proc;
+    task->channels = calloc(n, sizeof(Channel));
+    char * in = malloc((size_t)FRAME_BUF_SIZE * n);
+    if (task->channels == NULL || in == NULL) {
+        return -1;
+    }
+
+    for (node_id i = 0; i < n; i++) {
+        Channel * ch = &task->channels[i];
+        ch->in = in + (size_t)FRAME_BUF_SIZE * i;
+        if (i == task->local_pid) {
+            ch->rd = ch->wr = -1;
+            continue;
+        }
+        int slot = get_pipe(task, i, task->local_pid);
+        ch->rd = task->pipes[slot + 1][0];
+        ch->wr = task->pipes[slot][1];
+    }
+
+    return 0;
+}
+
+/**
+ * @return number of bytes read, 0 if pipe is empty, -1 on EOF or error
+ */
+int frame_fill(Channel * ch, int fd)
+{
+    stats_syscall();
+    ssize_t len = read(fd, ch->in + ch->in_len, FRAME_BUF_SIZE - ch->in_len);
+    if (len > 0) {
+        ch->in_len += len;
+        return len;
+    }
+    if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+        if (errno == EAGAIN) {
+            stats_eagain();
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static size_t frame_len(const char * frame)
+{
+    return sizeof(MessageHeader) + ((const MessageHeader *)frame)->s_payload_len;
+}
+
+int frame_ready(const Channel * ch)
+{
+    return ch->in_len >= sizeof(MessageHeader) && ch->in_len >= frame_len(ch->in);
+}
+
+/**
+ * @return whole frame at the head of input buffer or NULL
+ */
+const Message * frame_peek(const Channel * ch)
+{
+    return frame_ready(ch) ? (const Message *)ch->in : NULL;
+}
+
+/**
+ * Drop frame at the head of input buffer
+ */
+void frame_drop(Channel * ch)
+{
+    size_t len = frame_len(ch->in);
+    ch->in_len -= len;
+    memmove(ch->in, ch->in + len, ch->in_len);
+    ch->frames_in++;
+}
+
+int frame_next(Channel * ch, Message * msg)
+{
+    if (!frame_ready(ch)) {
+        return -1;
+    }
+
+    memcpy(msg, ch->in, frame_len(ch->in));
+    frame_drop(ch);
+    return 0;
+}
+
+int frame_queue(Channel * ch, const void * buf, size_t len)
+{
+    if (ch->out_len + len > ch->out_cap) {
+        size_t cap = ch->out_cap ? ch->out_cap : FRAME_BUF_SIZE;
+        while (cap < ch->out_len + len) {
+            cap *= 2;
+        }
+        char * out = realloc(ch->out, cap);
+        if (out == NULL) {
+            return -1;
+        }
+        ch->out = out;
+        ch->out_cap = cap;
+    }
+
+    memcpy(ch->out + ch->out_len, buf, len);
+    ch->out_len += len;
+    return 0;
+}
+
+/**
+ * @return 0 if everything is written, 1 if something is still pending,
+ *         -1 on error
+ */
+int frame_flush(Channel * ch, int fd)
+{
+    while (ch->out_len > 0) {
+        stats_syscall();
+        ssize_t len = write(fd, ch->out, ch->out_len);
+        if (len < 0) {
+            if (errno == EAGAIN) {
+                stats_eagain();
+                return 1;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("frame_flush write error");
+            return -1;
+        }
+        ch->out_len -= len;
+        memmove(ch->out, ch->out + len, ch->out_len);
+    }
+
+    return 0;
+}
+
+/**
+ * Queue frame behind pending output of the channel. Once the queue
+ * would outgrow FRAME_BUF_SIZE, queue and frame go out in one writev
+ *
+ * @return 0 if nothing is pending, 1 if something is queued,
+ *         -1 on error
+ */
+int frame_write(Channel * ch, int fd, const void * buf, size_t len)
+{
+    ch->frames_out++;
+    if (ch->out_len + len <= FRAME_BUF_SIZE) {
+        return RC_FAIL(frame_queue(ch, buf, len)) ? -1 : 1;
+    }
+
+    struct iovec iov[2] = {{ch->out, ch->out_len}, {(void *)buf, len}};
+    ssize_t written;
+    do {
+        stats_syscall();
+        written = writev(fd, iov, 2);
+    } while (written < 0 && errno == EINTR);
+    if (written < 0) {
+        if (errno != EAGAIN) {
+            perror("frame_write writev error");
+            return -1;
+        }
+        stats_eagain();
+        written = 0;
+    }
+
+    // drop written head of the queue, then queue unwritten tail of the frame
+    size_t queued = (size_t)written < ch->out_len ? (size_t)written : ch->out_len;
+    ch->out_len -= queued;
+    memmove(ch->out, ch->out + queued, ch->out_len);
+
+    size_t sent = written - queued;
+    if (sent < len && RC_FAIL(frame_queue(ch, (const char *)buf + sent, len - sent))) {
+        return -1;
+    }
+    return ch->out_len > 0;
+}
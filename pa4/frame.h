@@ -0,0 +1,49 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ipc.h"
+#include "proc.h"
+
+enum {
+    FRAME_BUF_SIZE = 4 * MAX_MESSAGE_LEN
+};
+
+/* Per-peer entry of the channel table, indexed by node_id */
+struct Channel
+{
+    int rd;           ///< read end of the pipe from the peer, -1 if none
+    int wr;           ///< write end of the pipe to the peer, -1 if none
+
+    char * in;        ///< bytes read from the pipe but not taken as frames yet
+    size_t in_len;
+
+    char * out;       ///< bytes accepted by send but not written to the pipe yet
+    size_t out_len;
+    size_t out_cap;
+    int out_polled;   ///< write end waits for EPOLLOUT in the readiness set
+
+    uint32_t frames_in;  ///< frames taken out of the input buffer
+    uint32_t frames_out; ///< frames accepted by send
+};
+
+int channel_init(TaskStruct * task);
+
+int frame_fill(Channel * ch, int fd);
+
+int frame_ready(const Channel * ch);
+
+int frame_next(Channel * ch, Message * msg);
+
+const Message * frame_peek(const Channel * ch);
+
+void frame_drop(Channel * ch);
+
+int frame_queue(Channel * ch, const void * buf, size_t len);
+
+int frame_write(Channel * ch, int fd, const void * buf, size_t len);
+
+int frame_flush(Channel * ch, int fd);
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file     ipc_ext.h
+ * @brief    Extended id and header space next to the classic ipc.h
+ *
+ * ipc.h addresses processes with 8-bit local_id and stamps messages
+ * with 16-bit time. Labs built on this header may go beyond that:
+ *
+ * - node_id is 16 bits wide, send_to and receive_from take it where
+ *   send and receive of ipc.h would truncate
+ * - ext_wrap appends a trailer with 64-bit time to a message,
+ *   ext_time reads it back and falls back to s_local_time for
+ *   classic messages, so both kinds may travel on the same channels
+ *
+ *    +-------------------------------+---------+------------+
+ *    | MessageHeader                 | payload | ExtTrailer |
+ *    | (magic = EXT_MESSAGE_MAGIC,   |         |            |
+ *    |  s_payload_len covers trailer)|         |            |
+ *    +-------------------------------+---------+------------+
+ *
+ * Payload stays where it was, s_local_time keeps the low bits of time.
+ */
+
+#ifndef IPC_EXT_H_
+#define IPC_EXT_H_
+
+#include "ipc.h"
+
+typedef int16_t node_id;
+typedef int64_t timestamp_ext_t;
+
+/// Ids fit node_id, the rest is bounded by descriptors and memory
+#define MAX_NODE_ID 1023
+
+/// Marks a message carrying ExtTrailer
+#define EXT_MESSAGE_MAGIC 0xAFB2
+
+typedef struct {
+    timestamp_ext_t s_time;
+} __attribute__((packed)) ExtTrailer;
+
+enum {
+    MAX_EXT_PAYLOAD_LEN = MAX_PAYLOAD_LEN - sizeof(ExtTrailer)
+};
+
+/** Send a message to the process with given node_id.
+ *
+ * @return 0 on success, any non-zero value on error
+ */
+int send_to(void * self, node_id dst, const Message * msg);
+
+/** Receive a message from the process with given node_id.
+ *
+ * @return 0 on success, any non-zero value on error
+ */
+int receive_from(void * self, node_id from, Message * msg);
+
+/** Copy message with the extended trailer carrying given time.
+ *
+ * @return 0 on success, -1 if the payload leaves no room for the trailer
+ */
+int ext_wrap(const Message * msg, timestamp_ext_t time, Message * out);
+
+/** @return time of extended message or s_local_time of classic one */
+timestamp_ext_t ext_time(const Message * msg);
+
+/** @return payload length without the extended trailer */
+uint16_t ext_payload_len(const Message * msg);
+#endif
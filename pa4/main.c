@@ -3,6 +3,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <wait.h>
@@ -11,69 +12,96 @@
 #include "common.h"
 #include "ipc.h"
 #include "pa2345.h"
+#include "binlog.h"
+#include "clock.h"
+#include "evlog.h"
+#include "latency.h"
+#include "mutex.h"
 #include "pipes.h"
+#include "spawn.h"
+#include "stats.h"
+#include "timeline.h"
+#include "trace.h"
 #include "proc.h"
 
-#define PA3_MAX(x, y) ((x > y) ? x : y)
+/// STARTED and DONE lines of pa2345.h past the time, which log_time writes
+static const char * const log_started_tail_fmt =
+    ": process %1d (pid %5d, parent %5d) has STARTED with balance $%2d\n";
 
-timestamp_t g_time = 0;
+static const char * const log_done_tail_fmt =
+    ": process %1d has DONE with balance $%2d\n";
 
-timestamp_t time_cmp_and_set(timestamp_t time)
+/**
+ * Time in front of a log line, the whole clock with --ext where
+ * timestamp_t of get_lamport_time would wrap
+ *
+ * @return number of chars written
+ */
+static int log_time(char * buf)
 {
-    g_time = PA3_MAX(g_time, time);
-    return g_time;
-}
-
-timestamp_t time_inc()
-{
-    return ++g_time;
-}
-
-timestamp_t get_lamport_time()
-{
-    return g_time;
+    if (g_ext) {
+        return sprintf(buf, "%lld", (long long)g_time);
+    }
+    return sprintf(buf, "%d", get_lamport_time());
 }
 
 int event_log(TaskStruct * this, const char * msg, int length)
 {
+    if (this->evlog) {
+        return evlog_append(this->local_pid, g_time, msg, length);
+    }
     write(STDOUT_FILENO, msg, length);
     return (write(this->events_log_fd, msg, length) < 0) ? -1 : 0;
 }
 
-int event_log_printf(TaskStruct * this, const char * fmt, ...)
+static int event_log_write(TaskStruct * this, const char * buf, int len)
+{
+    if (this->evlog) {
+        return evlog_append(this->local_pid, g_time, buf, len);
+    }
+    return (write(this->events_log_fd, buf, len) < 0) ? -1 : 0;
+}
+
+int trace_printf(TaskStruct * this, const char * file, int line, const char * fmt, ...)
 {
     va_list argp;
 
     va_start(argp, fmt);
 
     char buf[4096];
-    int len = vsprintf(buf, fmt, argp);
-    int rc = (write(this->events_log_fd, buf, len) < 0) ? -1 : 0;
+    int len = snprintf(buf, sizeof(buf), "%s[%d]: ", file, line);
+    len += vsnprintf(buf + len, sizeof(buf) - len, fmt, argp);
     va_end(argp);
-    return rc;
+    return event_log_write(this, buf, (len < (int)sizeof(buf)) ? len : (int)sizeof(buf) - 1);
 }
 
-int create_message(Message * msg, MessageType type, const MessagePayload * payload)
+/**
+ * @param names comma separated categories: fsm, cs, queue, all or none
+ *
+ * @return category mask, -1 on unknown name
+ */
+int trace_parse(const char * names)
 {
-    MessageHeader header;
-    header.s_magic = MESSAGE_MAGIC;
-    header.s_type = type;
-    header.s_local_time = get_lamport_time();
-
-    if (payload == NULL) {
-        msg->s_header = header;
-        msg->s_header.s_payload_len = 0;
-        return 0;
-    }
-
-    if (payload->s_size > MAX_PAYLOAD_LEN) {
-        return 1;
+    static const struct {
+        const char * name;
+        int mask;
+    } categories[] = {{"fsm", TRACE_FSM}, {"cs", TRACE_CS}, {"queue", TRACE_QUEUE}, {"all", TRACE_ALL}, {"none", 0}};
+
+    int mask = 0;
+    while (*names) {
+        size_t len = strcspn(names, ",");
+        size_t i = 0;
+        while (i < sizeof(categories) / sizeof(categories[0]) &&
+               (strlen(categories[i].name) != len || strncmp(categories[i].name, names, len) != 0)) {
+            i++;
+        }
+        if (i == sizeof(categories) / sizeof(categories[0])) {
+            return -1;
+        }
+        mask |= categories[i].mask;
+        names += len + (names[len] == ',');
     }
-    header.s_payload_len = payload->s_size;
-
-    msg->s_header = header;
-    memcpy(msg->s_payload, payload->s_data, payload->s_size);
-    return 0;
+    return mask;
 }
 
 enum ParentFSM {
@@ -85,45 +113,71 @@ enum ParentFSM {
 };
 typedef enum ParentFSM ParentFSM;
 
+// names for the timeline, in the order of ParentFSM
+static const char * ParentFSM_names[] = {
+    "p_init",
+    "p_starting",
+    "p_stopping",
+    "p_stopped",
+    "p_terminate"
+};
+
 void parent_fsm(TaskStruct * this)
 {
     ParentFSM state = p_init;
     Message * msg;
-    size_t replies = 0;
+    node_id from;
+    size_t started = 0;
+    size_t done = 0;
 
     while (1) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, ParentFSM_names[state], g_time);
+        }
+        stats_state(state, ParentFSM_names[state]);
         switch (state) {
         case p_init:
-            msg = malloc(sizeof(Message));
-
             close_redundant_pipes(this);
 
             state = p_starting;
             break;
         case p_starting:
-            receive_any(this, msg);
-            if (msg->s_header.s_type != STARTED) {
-                event_log_printf(this, "%s[%d]: unexpected message instead of STARTED: %d\n", __FILE__, __LINE__, msg->s_header.s_type);
+            msg = receive_next(this, &from);
+            if (msg == NULL) {
                 state = p_terminate;
                 continue;
             }
-            if (++replies == this->total_proc - 1) {
-                state = p_stopping;
-                replies = 0;
+            // without the lock a fast child may be done before a slow one has started
+            switch (msg->s_header.s_type) {
+            case STARTED:
+                started++;
+                break;
+            case DONE:
+                done++;
+                break;
+            default:
+                TRACE(this, TRACE_FSM, TRACE_ERROR, "unexpected message instead of STARTED: %d\n", msg->s_header.s_type);
+                state = p_terminate;
+                continue;
+            }
+            if (started == this->total_proc - 1) {
+                state = (done == this->total_proc - 1) ? p_stopped : p_stopping;
             }
             break;
         case p_stopping:
-            receive_any(this, msg);
-            if (msg->s_header.s_type != DONE) {
-                event_log_printf(this, "%s[%d]: unexpected message instead of DONE: %d\n", __FILE__, __LINE__, msg->s_header.s_type);
+            msg = receive_next(this, &from);
+            if (msg == NULL || msg->s_header.s_type != DONE) {
+                TRACE(this, TRACE_FSM, TRACE_ERROR, "unexpected message instead of DONE: %d\n", msg ? msg->s_header.s_type : -1);
                 state = p_terminate;
                 continue;
             }
-            if (++replies == this->total_proc - 1) {
+            if (++done == this->total_proc - 1) {
                 state = p_stopped;
             }
             break;
         case p_stopped:
+            // tree broadcasts may still be forwarded through us
+            send_flush(this);
             for (int i = 0; i < this->total_proc - 1; i++) {
                 wait(NULL);
             }
@@ -146,13 +200,27 @@ enum ChildFSM {
 };
 typedef enum ChildFSM ChildFSM;
 
+// names for the timeline, in the order of ChildFSM
+static const char * ChildFSM_names[] = {
+    "c_init",
+    "c_starting",
+    "c_work",
+    "c_stopping",
+    "c_stopped",
+    "c_terminate"
+};
+
 void child_fsm(TaskStruct * this)
 {
     ChildFSM state = c_init;
     char log_msg[MAX_PAYLOAD_LEN];
     Message * msg;
-    local_id replies = 0;
+    node_id replies = 0;
     while (1) {
+        if (this->timeline) {
+            (void)timeline_state(this, state, ChildFSM_names[state], g_time);
+        }
+        stats_state(state, ChildFSM_names[state]);
         switch (state) {
         case c_init: {
             msg = malloc(sizeof(Message));
@@ -160,13 +228,13 @@ void child_fsm(TaskStruct * this)
             close_redundant_pipes(this);
 
             time_inc();
-            int size = sprintf(log_msg,
-                               log_started_fmt,
-                               get_lamport_time(),
-                               this->local_pid,
-                               getpid(),
-                               getppid(),
-                               0 /* balance */);
+            int size = log_time(log_msg);
+            size += sprintf(log_msg + size,
+                            log_started_tail_fmt,
+                            this->local_pid,
+                            getpid(),
+                            getppid(),
+                            0 /* balance */);
 
             if (RC_FAIL(event_log(this, log_msg, size))) {
                 perror("write ev_log error");
@@ -176,7 +244,7 @@ void child_fsm(TaskStruct * this)
 
             MessagePayload payload = (MessagePayload){log_msg, size + 1};
             if (RC_FAIL(create_message(msg, STARTED, &payload))) {
-                event_log_printf(this, "%s[%d]: Can not create message\n", __FILE__, __LINE__);
+                TRACE(this, TRACE_FSM, TRACE_ERROR, "Can not create message\n");
                 state = c_terminate;
                 continue;
             }
@@ -184,41 +252,76 @@ void child_fsm(TaskStruct * this)
 
             state = c_starting;
         } break;
-        case c_starting:
+        case c_starting: {
             if (replies >= this->total_proc - 1 - 1) {
                 state = c_work;
                 continue;
             }
-            receive_any(this, msg);
-            if (msg->s_header.s_type != STARTED) {
-                event_log_printf(this, "%s[%d]: unexpected message instead of STARTED: %d\n", __FILE__, __LINE__, msg->s_header.s_type);
+            node_id from;
+            const Message * in = receive_next(this, &from);
+            if (in == NULL) {
                 state = c_terminate;
                 continue;
             }
-            (void)time_cmp_and_set(msg->s_header.s_local_time);
+            (void)time_cmp_and_set(ext_time(in));
             (void)time_inc();
 
-            replies++;
-
-            break;
+            // faster processes may already be working
+            switch (in->s_header.s_type) {
+            case STARTED:
+                replies++;
+                break;
+            case CS_REQUEST: {
+                Item item = (Item){ext_time(in), from};
+                if (RC_FAIL(push_item(this, item))) {
+                    state = c_terminate;
+                    continue;
+                }
+                (void)time_inc();
+                create_message(msg, CS_REPLY, NULL);
+                send_to(this, from, msg);
+            } break;
+            case CS_RELEASE:
+                // peer got through its section while a STARTED
+                // of somebody else is still on the way
+                if (RC_FAIL(remove_item(this, from))) {
+                    state = c_terminate;
+                    continue;
+                }
+                break;
+            case DONE:
+                this->done++;
+                break;
+            default:
+                TRACE(this, TRACE_FSM, TRACE_ERROR, "unexpected message instead of STARTED: %d\n", in->s_header.s_type);
+                state = c_terminate;
+                continue;
+            }
+        } break;
         case c_work: {
             const uint32_t to = this->local_pid * 5;
             for (uint32_t i = 1; i <= to; i++) {
                 if (RC_FAIL(request_cs(this))) {
-                    event_log_printf(this, "%s[%d]: Process %d request CS failed\n", __FILE__, __LINE__, this->local_pid);
+                    TRACE(this, TRACE_FSM, TRACE_ERROR, "Process %d request CS failed\n", this->local_pid);
                     state = c_terminate;
                     continue;
                 }
-                event_log_printf(this, "%s[%d]: Process %d started to work %u\n", __FILE__, __LINE__, this->local_pid, i);
+                if (this->timeline) {
+                    (void)timeline_mark(this, TIMELINE_CS_ENTER, g_time);
+                }
+                TRACE(this, TRACE_FSM, TRACE_INFO, "Process %d started to work %u\n", this->local_pid, i);
                 (void)sprintf(log_msg,
                               log_loop_operation_fmt,
                               this->local_pid,
                               i,
                               to);
                 print(log_msg);
-                event_log_printf(this, "%s[%d]: Process %d have finished work %u\n", __FILE__, __LINE__, this->local_pid, i);
+                TRACE(this, TRACE_FSM, TRACE_INFO, "Process %d have finished work %u\n", this->local_pid, i);
+                if (this->timeline) {
+                    (void)timeline_mark(this, TIMELINE_CS_EXIT, g_time);
+                }
                 if (RC_FAIL(release_cs(this))) {
-                    event_log_printf(this, "%s[%d]: Process %d release CS failed\n", __FILE__, __LINE__, this->local_pid);
+                    TRACE(this, TRACE_FSM, TRACE_ERROR, "Process %d release CS failed\n", this->local_pid);
                     state = c_terminate;
                     continue;
                 }
@@ -226,11 +329,11 @@ void child_fsm(TaskStruct * this)
 
             time_inc();
 
-            int size = sprintf(log_msg,
-                               log_done_fmt,
-                               get_lamport_time(),
-                               this->local_pid,
-                               0 /* balance */);
+            int size = log_time(log_msg);
+            size += sprintf(log_msg + size,
+                            log_done_tail_fmt,
+                            this->local_pid,
+                            0 /* balance */);
 
             if (RC_FAIL(event_log(this, log_msg, size))) {
                 perror("write ev_log error");
@@ -240,7 +343,7 @@ void child_fsm(TaskStruct * this)
 
             MessagePayload payload = (MessagePayload){log_msg, size + 1};
             if (RC_FAIL(create_message(msg, DONE, &payload))) {
-                event_log_printf(this, "%s[%d]: Can not create message\n", __FILE__, __LINE__);
+                TRACE(this, TRACE_FSM, TRACE_ERROR, "Can not create message\n");
                 state = c_terminate;
                 continue;
             }
@@ -249,259 +352,134 @@ void child_fsm(TaskStruct * this)
             state = c_stopping;
         } break;
         case c_stopping:
-            event_log_printf(this, "%s[%d]: Process %d stopping, replies %u\n", __FILE__, __LINE__, this->local_pid, this->done);
+            TRACE(this, TRACE_FSM, TRACE_DEBUG, "Process %d stopping, replies %u\n", this->local_pid, this->done);
             if (this->done == this->total_proc - 1 - 1) {
                 state = c_stopped;
                 continue;
             }
-            local_id from = receive_any(this, msg);
-            event_log_printf(this, "%s[%d]: Process %d stopping, received message %d\n", __FILE__, __LINE__, this->local_pid, msg->s_header.s_type);
+            node_id from;
+            const Message * in = receive_next(this, &from);
+            if (in == NULL) {
+                state = c_terminate;
+                continue;
+            }
+            TRACE(this, TRACE_FSM, TRACE_DEBUG, "Process %d stopping, received message %d\n", this->local_pid, in->s_header.s_type);
 
-            (void)time_cmp_and_set(msg->s_header.s_local_time);
+            (void)time_cmp_and_set(ext_time(in));
             (void)time_inc();
 
-            switch (msg->s_header.s_type) {
+            switch (in->s_header.s_type) {
             case DONE:
                 this->done++;
                 break;
             case CS_REQUEST:
                 create_message(msg, CS_REPLY, NULL);
-                send(this, from, msg);
+                send_to(this, from, msg);
                 break;
             default:
                 break;
             }
             break;
         case c_stopped:
-            event_log_printf(this, "%s[%d]: Process %d successfuly exited\n", __FILE__, __LINE__, this->local_pid);
+            TRACE(this, TRACE_FSM, TRACE_INFO, "Process %d successfuly exited\n", this->local_pid);
+            send_flush(this);
             exit(EXIT_SUCCESS);
             break;
         case c_terminate:
-            event_log_printf(this, "%s[%d]: Process %d exit by an error\n", __FILE__, __LINE__, this->local_pid);
+            TRACE(this, TRACE_FSM, TRACE_ERROR, "Process %d exit by an error\n", this->local_pid);
             exit(EXIT_FAILURE);
             break;
         }
     }
 }
 
-int send_multicast_except_main(void * self, const Message * msg)
-{
-    TaskStruct * task = self;
-    for (local_id dst = 1; dst < task->total_proc; dst++) {
-        if (dst == task->local_pid) {
-            continue;
-        }
-        if (RC_FAIL(send(self, dst, msg))) {
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-int item_comparator(const void * a, const void * b)
-{
-    const Item * lhs = (const Item *)a;
-    const Item * rhs = (const Item *)b;
-    if (lhs->time == rhs->time) {
-        if (lhs->pid < rhs->pid) {
-            return -1;
-        }
-        return 1;
-    }
-    if (lhs->time < rhs->time) {
-        return -1;
-    }
-    return 1;
-}
-
-int push_item(TaskStruct * this, Item item)
-{
-    if (this->queue_size == this->queue_capacity) {
-        event_log_printf(this, "Queue capacity breached for process %d for item (%d,%d)\n", this->local_pid, item.time, item.pid);
-        return -1;
-    }
-    this->queue[this->queue_size++] = item;
-    qsort(this->queue, this->queue_size, sizeof(Item), &item_comparator);
-
-    for (int i = 0; i < this->queue_size; i++) {
-        event_log_printf(this, "%s[%d]: Process %d add queue n=%d (%d,%d)\n", __FILE__, __LINE__, this->local_pid, i, this->queue[i].time, this->queue[i].pid);
-    }
-
-    return 0;
-}
-
-int remove_item(TaskStruct * this, local_id from)
-{
-    if (this->queue[0].pid != from) {
-        event_log_printf(this, "Head of queue is not busy by %d", from);
-        return -1;
-    }
-    for (int i = 0; i < this->queue_size; i++) {
-        if (this->queue[i].pid == from) {
-            // exchange removable item and the last one
-            this->queue[i].pid = this->queue[--this->queue_size].pid;
-            this->queue[i].time = this->queue[this->queue_size].time;
-
-            this->queue[this->queue_size].pid = 0;
-            this->queue[this->queue_size].time = 0;
-
-            // restore total order
-            qsort(this->queue, this->queue_size, sizeof(Item), &item_comparator);
-
-            for (int i = 0; i < this->queue_size; i++) {
-                event_log_printf(this, "%s[%d]: Process %d remove queue n=%d (%d,%d)\n", __FILE__, __LINE__, this->local_pid, i, this->queue[i].time, this->queue[i].pid);
-            }
-            return 0;
-        }
-    }
-
-    perror("Trying to remove request that doesn't exist");
-    return -1;
-}
-
-int request_cs(const void * self)
-{
-    TaskStruct * this = (TaskStruct *)self;
-
-    if (!this->locking) {
-        return 0;
-    }
-
-    event_log_printf(this, "%s[%d]: Process %d request cs\n", __FILE__, __LINE__, this->local_pid);
-
-    (void)time_inc();
-
-    // request to go in critical section
-
-    // send REQUEST to everyone
-
-    // add request to local queue
-    Item item = (Item){get_lamport_time(), this->local_pid};
-    if (RC_FAIL(push_item(this, item))) {
-        return -1;
-    }
-
-    Message msg;
-    create_message(&msg, CS_REQUEST, NULL);
-    send_multicast_except_main(this, &msg);
-    event_log_printf(this, "%s[%d]: Process %d request cs sent\n", __FILE__, __LINE__, this->local_pid);
-
-    // wait for total_proc - 1 replies (except main process)
-    // or total_proc - 2 requests
-
-    // go in critical section
-
-    // if our process's request is in the head of the queue
-    // then go in critical section
-
-    // otherwise wait for all processes on the left side of us
-
-    // in queue have released their locks
-
-    int allowed = this->total_proc < 3 ? 1 : 0;
-    size_t replies = 0;
-    while (!allowed) {
-        local_id from = receive_any(this, &msg);
-        event_log_printf(this, "%s[%d]: Process %d message received from %d\n", __FILE__, __LINE__, this->local_pid, from);
-        (void)time_cmp_and_set(msg.s_header.s_local_time);
-        (void)time_inc();
-        switch (msg.s_header.s_type) {
-        case CS_REQUEST:
-            item.pid = from;
-            item.time = msg.s_header.s_local_time;
-            event_log_printf(this, "%s[%d]: Process %d request cs received (%d,%d)\n", __FILE__, __LINE__, this->local_pid, item.time, item.pid);
-            if (RC_FAIL(push_item(this, item))) {
-                return -1;
-            }
-            (void)time_inc();
-            create_message(&msg, CS_REPLY, NULL);
-            if (RC_FAIL(send(this, from, &msg))) {
-                return -1;
-            }
-            event_log_printf(this, "%s[%d]: Process %d request reply sent\n", __FILE__, __LINE__, this->local_pid);
-            break;
-        case CS_RELEASE:
-            event_log_printf(this, "%s[%d]: Process %d release received\n", __FILE__, __LINE__, this->local_pid);
-            if (RC_FAIL(remove_item(this, from))) {
-                return -1;
-            }
-            if (replies == this->total_proc - 1 - 1 &&
-                this->queue[0].pid == this->local_pid) {
-                allowed = 1;
-            }
-            break;
-        case CS_REPLY:
-            event_log_printf(this, "%s[%d]: Process %d reply received\n", __FILE__, __LINE__, this->local_pid);
-            // queue is non empty as we're here
-            if (++replies == this->total_proc - 1 - 1 &&
-                this->queue[0].pid == this->local_pid) {
-                allowed = 1;
-            }
-            break;
-        case DONE:
-            this->done++;
-            break;
-        default:
-            event_log_printf(this, "%s[%d]: Process %d unexpected message %d\n", __FILE__, __LINE__, this->local_pid, msg.s_header.s_type);
-            return -1;
-        break;
-        }
-    }
-
-    event_log_printf(this, "%s[%d]: Process %d request cs finish\n", __FILE__, __LINE__, this->local_pid);
-
-    return 0;
-}
-
-int release_cs(const void * self)
-{
-    TaskStruct * this = (TaskStruct *)self;
-
-    if (!this->locking) {
-        return 0;
-    }
-
-    event_log_printf(this, "%s[%d]: Process %d release cs\n", __FILE__, __LINE__, this->local_pid);
-
-    (void)time_inc();
-
-    // remove our request from local queue
-    // send release to total_proc - 1
-
-    Message msg;
-    create_message(&msg, CS_RELEASE, NULL);
-
-    if (RC_FAIL(remove_item(this, this->local_pid))) {
-        return -1;
-    }
-    send_multicast_except_main(this, &msg);
-
-    event_log_printf(this, "%s[%d]: Process %d release cs finished\n", __FILE__, __LINE__, this->local_pid);
-
-    return 0;
-}
-
 int main(int argc, char * argv[])
 {
     if (argc < 2) {
-        fprintf(stderr, "./lab <N processes to run> [--mutexl]\n");
+        fprintf(stderr, "./lab <N processes to run> [--mutexl] [--transport pipe|shm|inbox|uring|seqpacket] [--multicast flat|tree] [--spawn flat|tree] [--lazy] [--ext] [--binlog] [--evlog] [--timeline] [--stats] [--latency] [--trace fsm,cs,queue|all|none]\n");
         return 1;
     }
     int proc_count = -1;
     static const struct option long_options[] = {
             {"mutexl", no_argument, 0, 'm'},
+            {"transport", required_argument, 0, 't'},
+            {"multicast", required_argument, 0, 'b'},
+            {"spawn", required_argument, 0, 's'},
+            {"lazy", no_argument, 0, 'l'},
+            {"ext", no_argument, 0, 'x'},
+            {"binlog", no_argument, 0, 'B'},
+            {"evlog", no_argument, 0, 'E'},
+            {"timeline", no_argument, 0, 'L'},
+            {"stats", no_argument, 0, 'S'},
+            {"latency", no_argument, 0, 'H'},
+            {"trace", required_argument, 0, 'T'},
+            {0, 0, 0, 0}
     };
     int locking = 0;
+    int transport = TRANSPORT_PIPE;
+    int multicast = MULTICAST_FLAT;
+    int spawn_type = SPAWN_FLAT;
+    int lazy = 0;
+    int binlog = 0;
+    int evlog = 0;
+    int timeline = 0;
+    int stats = 0;
+    int latency = 0;
+    int trace = TRACE_FSM;
     int loop = 1;
     while (loop) {
-        switch (getopt_long(argc, argv, "mp:", long_options, NULL)) {
+        switch (getopt_long(argc, argv, "mp:t:b:s:lxBELSHT:", long_options, NULL)) {
         case 'p':
             proc_count = atoi(optarg);
             break;
         case 'm':
             locking = 1;
             break;
+        case 't':
+            if ((transport = transport_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown transport %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            if ((multicast = multicast_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown multicast %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            if ((spawn_type = spawn_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown spawn %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'l':
+            lazy = 1;
+            break;
+        case 'x':
+            g_ext = 1;
+            break;
+        case 'B':
+            binlog = 1;
+            break;
+        case 'E':
+            evlog = 1;
+            break;
+        case 'L':
+            timeline = 1;
+            break;
+        case 'S':
+            stats = 1;
+            break;
+        case 'H':
+            latency = 1;
+            break;
+        case 'T':
+            if ((trace = trace_parse(optarg)) < 0) {
+                fprintf(stderr, "Unknown trace category in %s\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case -1:
             loop = 0;
             break;
@@ -510,7 +488,7 @@ int main(int argc, char * argv[])
         }
     }
 
-    if (proc_count <= 0 || proc_count > 10) {
+    if (proc_count <= 0 || proc_count > (g_ext ? MAX_NODE_ID : 10)) {
         fprintf(stderr, "Invalid amount of child processes to create\n");
         exit(EXIT_FAILURE);
     }
@@ -519,39 +497,50 @@ int main(int argc, char * argv[])
     task.total_proc = proc_count + 1;
     task.local_pid = 0;
     task.locking = locking;
-
-    if ((task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    task.transport = transport;
+    task.multicast = multicast;
+    task.spawn = spawn_type;
+    task.lazy = lazy;
+    task.binlog = binlog;
+    task.evlog = evlog;
+    task.timeline = timeline;
+    task.trace = trace;
+
+    // with segments events.log is made by evlog_merge
+    task.events_log_fd = -1;
+    if (!evlog && (task.events_log_fd = open(events_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("events log open error");
         exit(EXIT_FAILURE);
     }
-    if ((task.pipe_log_fd = open(pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
+    if ((task.pipe_log_fd = open(binlog ? BINLOG_FILE : pipes_log, LOG_FILE_FLAGS, MODE)) < 0) {
         perror("pipe log open error");
         exit(EXIT_FAILURE);
     }
 
+    if (stats && RC_FAIL(stats_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
+    if (latency && RC_FAIL(latency_init(&task))) {
+        exit(EXIT_FAILURE);
+    }
     if (RC_FAIL(pipe_init(&task))) {
         perror("pipe init failed");
         exit(EXIT_FAILURE);
     }
 
-    for (local_id i = 1; i < task.total_proc; i++) {
-        switch (fork()) {
-        case -1:
-            perror("fork error");
-            exit(EXIT_FAILURE);
-        case 0: {
-            TaskStruct this = task;
-            this.local_pid = i;
-            // We can't receive more than total_proc requests except main
-            this.queue_capacity = this.total_proc - 1;
-            this.queue_size = 0;
-            this.done = 0;
-            this.queue = malloc(sizeof(Item) * this.queue_capacity);
-            child_fsm(&this);
-        } break;
-        default:
-            break;
-        }
+    node_id id = spawn(&task);
+    if (id < 0) {
+        exit(EXIT_FAILURE);
+    }
+    if (id != PARENT_ID) {
+        TaskStruct this = task;
+        this.local_pid = id;
+        // We can't receive more than total_proc requests except main
+        this.queue_capacity = this.total_proc - 1;
+        this.queue_size = 0;
+        this.done = 0;
+        this.queue = malloc(sizeof(Item) * this.queue_capacity);
+        child_fsm(&this);
     }
 
     parent_fsm(&task);
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pa2345.h"
+#include "mutex.h"
+#include "pipes.h"
+#include "trace.h"
+
+/* Lamport mutual exclusion of --mutexl
+ *
+ * Every process keeps a queue of requests ordered by (time, pid).
+ * request_cs stamps a request, queues it and multicasts it to the
+ * other children, then serves messages until every peer has replied
+ * and its own request is at the head. release_cs dequeues it and
+ * multicasts the release. A request costs 3 * (N - 1) messages.
+ *
+ * Clock and messages come from clock.c, which a benchmark links in
+ * along with this file, so it drives the same code the lab does.
+ */
+
+int send_multicast_except_main(void * self, const Message * msg)
+{
+    TaskStruct * task = self;
+    for (node_id dst = 1; dst < task->total_proc; dst++) {
+        if (dst == task->local_pid) {
+            continue;
+        }
+        if (RC_FAIL(send_to(self, dst, msg))) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int item_comparator(const void * a, const void * b)
+{
+    const Item * lhs = (const Item *)a;
+    const Item * rhs = (const Item *)b;
+    if (lhs->time == rhs->time) {
+        if (lhs->pid < rhs->pid) {
+            return -1;
+        }
+        return 1;
+    }
+    if (lhs->time < rhs->time) {
+        return -1;
+    }
+    return 1;
+}
+
+int push_item(TaskStruct * this, Item item)
+{
+    if (this->queue_size == this->queue_capacity) {
+        TRACE(this, TRACE_QUEUE, TRACE_ERROR, "Queue capacity breached for process %d for item (%lld,%d)\n", this->local_pid, (long long)item.time, item.pid);
+        return -1;
+    }
+    this->queue[this->queue_size++] = item;
+    qsort(this->queue, this->queue_size, sizeof(Item), &item_comparator);
+
+    for (int i = 0; TRACE_ON(this, TRACE_QUEUE, TRACE_DEBUG) && i < this->queue_size; i++) {
+        TRACE(this, TRACE_QUEUE, TRACE_DEBUG, "Process %d add queue n=%d (%lld,%d)\n", this->local_pid, i, (long long)this->queue[i].time, this->queue[i].pid);
+    }
+
+    return 0;
+}
+
+int remove_item(TaskStruct * this, node_id from)
+{
+    // Releases of different processes travel over different channels,
+    // so the one from the head may still be in flight: look up by pid
+    for (int i = 0; i < this->queue_size; i++) {
+        if (this->queue[i].pid == from) {
+            // exchange removable item and the last one
+            this->queue[i].pid = this->queue[--this->queue_size].pid;
+            this->queue[i].time = this->queue[this->queue_size].time;
+
+            this->queue[this->queue_size].pid = 0;
+            this->queue[this->queue_size].time = 0;
+
+            // restore total order
+            qsort(this->queue, this->queue_size, sizeof(Item), &item_comparator);
+
+            for (int i = 0; TRACE_ON(this, TRACE_QUEUE, TRACE_DEBUG) && i < this->queue_size; i++) {
+                TRACE(this, TRACE_QUEUE, TRACE_DEBUG, "Process %d remove queue n=%d (%lld,%d)\n", this->local_pid, i, (long long)this->queue[i].time, this->queue[i].pid);
+            }
+            return 0;
+        }
+    }
+
+    perror("Trying to remove request that doesn't exist");
+    return -1;
+}
+
+int request_cs(const void * self)
+{
+    TaskStruct * this = (TaskStruct *)self;
+
+    if (!this->locking) {
+        return 0;
+    }
+
+    TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d request cs\n", this->local_pid);
+
+    (void)time_inc();
+
+    // request to go in critical section
+
+    // send REQUEST to everyone
+
+    // add request to local queue
+    Item item = (Item){g_time, this->local_pid};
+    if (RC_FAIL(push_item(this, item))) {
+        return -1;
+    }
+
+    Message msg;
+    create_message(&msg, CS_REQUEST, NULL);
+    send_multicast_except_main(this, &msg);
+    TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d request cs sent\n", this->local_pid);
+
+    // wait for total_proc - 1 replies (except main process)
+    // or total_proc - 2 requests
+
+    // go in critical section
+
+    // if our process's request is in the head of the queue
+    // then go in critical section
+
+    // otherwise wait for all processes on the left side of us
+
+    // in queue have released their locks
+
+    int allowed = this->total_proc < 3 ? 1 : 0;
+    size_t replies = 0;
+    while (!allowed) {
+        node_id from;
+        const Message * in = receive_next(this, &from);
+        if (in == NULL) {
+            return -1;
+        }
+        TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d message received from %d\n", this->local_pid, from);
+        (void)time_cmp_and_set(ext_time(in));
+        (void)time_inc();
+        switch (in->s_header.s_type) {
+        case CS_REQUEST:
+            item.pid = from;
+            item.time = ext_time(in);
+            TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d request cs received (%lld,%d)\n", this->local_pid, (long long)item.time, item.pid);
+            if (RC_FAIL(push_item(this, item))) {
+                return -1;
+            }
+            (void)time_inc();
+            create_message(&msg, CS_REPLY, NULL);
+            if (RC_FAIL(send_to(this, from, &msg))) {
+                return -1;
+            }
+            TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d request reply sent\n", this->local_pid);
+            break;
+        case CS_RELEASE:
+            TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d release received\n", this->local_pid);
+            if (RC_FAIL(remove_item(this, from))) {
+                return -1;
+            }
+            if (replies == this->total_proc - 1 - 1 &&
+                this->queue[0].pid == this->local_pid) {
+                allowed = 1;
+            }
+            break;
+        case CS_REPLY:
+            TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d reply received\n", this->local_pid);
+            // queue is non empty as we're here
+            if (++replies == this->total_proc - 1 - 1 &&
+                this->queue[0].pid == this->local_pid) {
+                allowed = 1;
+            }
+            break;
+        case DONE:
+            this->done++;
+            break;
+        default:
+            TRACE(this, TRACE_CS, TRACE_ERROR, "Process %d unexpected message %d\n", this->local_pid, in->s_header.s_type);
+            return -1;
+        break;
+        }
+    }
+
+    TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d request cs finish\n", this->local_pid);
+
+    return 0;
+}
+
+int release_cs(const void * self)
+{
+    TaskStruct * this = (TaskStruct *)self;
+
+    if (!this->locking) {
+        return 0;
+    }
+
+    TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d release cs\n", this->local_pid);
+
+    (void)time_inc();
+
+    // remove our request from local queue
+    // send release to total_proc - 1
+
+    Message msg;
+    create_message(&msg, CS_RELEASE, NULL);
+
+    if (RC_FAIL(remove_item(this, this->local_pid))) {
+        return -1;
+    }
+    send_multicast_except_main(this, &msg);
+    // peers are waiting on it, don't hold it until our next receive
+    send_commit(this);
+
+    TRACE(this, TRACE_CS, TRACE_DEBUG, "Process %d release cs finished\n", this->local_pid);
+
+    return 0;
+}
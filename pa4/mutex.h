@@ -0,0 +1,22 @@
+#ifndef MUTEX_H_
+#define MUTEX_H_
+
+#include "clock.h"
+#include "ipc.h"
+#include "proc.h"
+
+/** Send a message to every child but the current one */
+int send_multicast_except_main(void * self, const Message * msg);
+
+/** Queue a request in (time, pid) order
+ *
+ * @return 0 on success, -1 when the queue is full
+ */
+int push_item(TaskStruct * this, Item item);
+
+/** Drop the request of the process from the queue
+ *
+ * @return 0 on success, -1 when there is none
+ */
+int remove_item(TaskStruct * this, node_id from);
+#endif
@@ -1,7 +1,10 @@
 #ifndef __IFMO_DISTRIBUTED_CLASS_PROC__H
 #define __IFMO_DISTRIBUTED_CLASS_PROC__H
 
+#include <sys/epoll.h>
+
 #include "ipc.h"
+#include "ipc_ext.h"
 #include "banking.h"
 
 #define LOG_FILE_FLAGS O_CREAT | O_WRONLY | O_APPEND | O_TRUNC
@@ -9,15 +12,93 @@
 #define RC_OK(x) (x == 0)
 #define RC_FAIL(x) !(RC_OK(x))
 
+typedef enum {
+    TRANSPORT_PIPE = 0, ///< N * (N - 1) nonblocking pipes
+    TRANSPORT_SHM,      ///< SPSC rings in memory shared before fork
+    TRANSPORT_INBOX,    ///< one pipe per process written by all peers
+    TRANSPORT_URING,    ///< pipe mesh driven through io_uring
+    TRANSPORT_SEQPACKET ///< unix seqpacket socketpair per pair of processes
+} TransportType;
+
+typedef enum {
+    MULTICAST_FLAT = 0, ///< sender writes to every peer
+    MULTICAST_TREE      ///< peers forward along a binomial tree
+} MulticastType;
+
+typedef enum {
+    SPAWN_FLAT = 0, ///< parent forks every child
+    SPAWN_TREE      ///< children fork their subtrees, O(log N) levels
+} SpawnType;
+
 typedef struct TaskStruct TaskStruct;
+typedef struct Channel Channel;
+typedef struct Uring Uring;
 typedef struct Item Item;
 
 struct TaskStruct
 {
-    local_id local_pid;
-    local_id total_proc;
+    node_id local_pid;
+    node_id total_proc;
+    TransportType transport;
+    MulticastType multicast;
+    SpawnType spawn;
     int (*pipes)[2];
 
+    // shared memory transport
+    void * shm;
+    size_t shm_size;
+    node_id ring_next;
+    int ring_spin;
+    Channel * ring_out; ///< frames waiting for room in the ring, indexed by peer
+
+    // inbox transport
+    int (*inboxes)[2];
+    char * inbox_buf;
+    size_t inbox_len;
+
+    // seqpacket transport, N * N matrix of sockets
+    int * sockets;
+
+    // shared slabs for multicast, mapped when there are 2+ receivers
+    void * slabs;
+    size_t slabs_size;
+    int slab_next;
+
+    // lazy pipe mesh, channels brokered by the parent on first use
+    int lazy;
+    int (*brokers)[2]; ///< control socket per child
+    char * brokered;   ///< parent only, N * N flags of channels set up
+
+    // framing and pending output of pipe channels, indexed by peer
+    Channel * channels;
+    Uring * uring;
+
+    // messages of the last receive_batch handed out by receive_next
+    Message * batch;
+    node_id * batch_from;
+    int batch_len;
+    int batch_pos;
+
+    // live counters in STATS_FILE, mapped before fork
+    void * stats;
+    size_t stats_size;
+
+    // send to receive latency histograms of every process, mapped before fork
+    void * latency;
+    size_t latency_size;
+
+    // message handed out by receive_view
+    node_id view_from;
+    int view_held;                ///< transport frame to drop on release_view
+    const Message * view_slab;    ///< slab message to drop reference of
+    Message * view_buf;           ///< frame copied out of the transport for a view
+
+    // receive_any readiness
+    int epoll_fd;
+    struct epoll_event * ready;
+    int ready_len;
+    int ready_pos;
+
     timestamp_t last_time;
 
     // --mutexl
@@ -31,11 +112,15 @@ struct TaskStruct
 
     // logging
     int pipe_log_fd;
+    int binlog;   ///< pipe_log_fd is pipes.bin with binary records
     int events_log_fd;
+    int evlog;    ///< events go to the segment of the process, see evlog.c
+    int timeline; ///< sends, receives and states go to timeline.<id>.bin
+    int trace;    ///< categories of trace.h switched on with --trace
 };
 
 struct Item {
-    timestamp_t time;
+    timestamp_ext_t time;
     int pid;
 };
 
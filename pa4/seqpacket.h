@@ -0,0 +1,18 @@
+#ifndef SEQPACKET_H_
+#define SEQPACKET_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+int seqpacket_init(TaskStruct * task);
+
+int seqpacket_attach(TaskStruct * task);
+
+int seqpacket_send(TaskStruct * task, node_id dst, const Message * msg);
+
+int seqpacket_receive(TaskStruct * task, node_id from, Message * msg);
+
+int seqpacket_receive_any(TaskStruct * task, Message * msg);
+
+int seqpacket_receive_batch(TaskStruct * task, Message * out, node_id * from, size_t max);
+#endif
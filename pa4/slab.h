@@ -0,0 +1,19 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include "ipc.h"
+#include "proc.h"
+
+/// Marks a frame that carries a reference to a slab instead of the message
+#define SLAB_MAGIC 0xAFB0
+
+int slab_init(TaskStruct * task);
+
+int slab_publish(TaskStruct * task, const Message * msg, Message * ref);
+
+const Message * slab_peek(TaskStruct * task, const Message * ref);
+
+void slab_drop(TaskStruct * task, const Message * msg);
+
+void slab_resolve(TaskStruct * task, Message * msg);
+#endif
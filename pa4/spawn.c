@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spawn.h"
+#include "tree.h"
+
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+
+/* Process startup
+ *
+ * Flat spawn is the classic loop: the parent forks every child
+ * itself, N - 1 forks one after another.
+ *
+ * Tree spawn forks along the binomial tree of the broadcast
+ * rooted at the parent: a new process first forks its own subtree
+ * and only then goes on with its work, so the last process is
+ * ceil(log2 N) forks away from the parent and forks run in parallel
+ * on different CPUs. For N = 8:
+ *
+ *    0 forks 4, 2, 1     4 forks 6, 5     2 forks 3     6 forks 7
+ *
+ * Forking processes don't wait for their children. The parent
+ * becomes a child subreaper, so processes left behind by exited
+ * ones are reparented to it and it still waits for all N - 1.
+ * getppid() of a process is its tree parent then.
+ */
+
+/**
+ * @return node_id of the calling process: PARENT_ID in the parent,
+ *         id of the child in every forked process, -1 on error
+ */
+node_id spawn(TaskStruct * task)
+{
+    if (task->spawn == SPAWN_FLAT) {
+        for (node_id i = 1; i < task->total_proc; i++) {
+            switch (fork()) {
+            case -1:
+                perror("fork error");
+                return -1;
+            case 0:
+                return i;
+            default:
+                break;
+            }
+        }
+        return PARENT_ID;
+    }
+
+    if (RC_FAIL(prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0))) {
+        perror("spawn prctl error");
+        return -1;
+    }
+
+    node_id self = task->local_pid;
+    node_id children[TREE_MAX_CHILDREN];
+    int count = tree_children(task, PARENT_ID, children);
+    for (int c = 0; c < count; c++) {
+        switch (fork()) {
+        case -1:
+            perror("fork error");
+            return -1;
+        case 0:
+            // from here on fork the subtree of this child
+            task->local_pid = children[c];
+            count = tree_children(task, PARENT_ID, children);
+            c = -1;
+            break;
+        default:
+            break;
+        }
+    }
+
+    node_id id = task->local_pid;
+    task->local_pid = self;
+    return id;
+}
+
+int spawn_parse(const char * name)
+{
+    if (strcmp(name, "flat") == 0) {
+        return SPAWN_FLAT;
+    }
+    if (strcmp(name, "tree") == 0) {
+        return SPAWN_TREE;
+    }
+    return -1;
+}
+
+static int close_run(int first, int last)
+{
+    if (syscall(__NR_close_range, first, last, 0) == 0) {
+        return 0;
+    }
+    if (errno != ENOSYS) {
+        return -1;
+    }
+    // kernels before 5.9
+    for (int fd = first; fd <= last; fd++) {
+        close(fd);
+    }
+    return 0;
+}
+
+/**
+ * Close every fd marked in drop, a run of marked fds in one call
+ *
+ * @param drop  count flags indexed by fd
+ *
+ * @return number of close calls made, -1 on error
+ */
+int close_fds(const char * drop, int count)
+{
+    int calls = 0;
+    for (int fd = 0; fd < count; fd++) {
+        if (!drop[fd]) {
+            continue;
+        }
+        int last = fd;
+        while (last + 1 < count && drop[last + 1]) {
+            last++;
+        }
+        if (RC_FAIL(close_run(fd, last))) {
+            perror("close_fds close_range error");
+            return -1;
+        }
+        calls++;
+        fd = last;
+    }
+    return calls;
+}
@@ -0,0 +1,85 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "banking.h"
+#include "binlog.h"
+
+/* Turn pipes.bin of --binlog into the text of pipes.log
+ *
+ *    binlog_decode [pipes.bin] > pipes.log
+ *
+ * Records of a process keep their order, processes are interleaved
+ * chunk by chunk as their rings were flushed.
+ */
+
+static void print_record(const BinlogRecord * rec, const char * text)
+{
+    printf("[%d %c %d] ", rec->self, (rec->direction) ? '>' : '<', rec->peer);
+
+    switch (rec->type) {
+    case STARTED:
+        printf("STARTED: %.*s", rec->payload_len, text);
+        break;
+    case DONE:
+        printf("DONE: %.*s", rec->payload_len, text);
+        break;
+    case ACK:
+        printf("ACK\n");
+        break;
+    case STOP:
+        printf("STOP\n");
+        break;
+    case TRANSFER: {
+        TransferOrder order;
+        memcpy(&order, rec->detail, sizeof(order));
+        printf("TRANSFER: [src=%d, dst=%d, amount=%d]\n", order.s_src, order.s_dst, order.s_amount);
+    } break;
+    case BALANCE_HISTORY: {
+        // only the head of BalanceHistory is in the record
+        local_id id;
+        uint8_t len;
+        memcpy(&id, rec->detail + offsetof(BalanceHistory, s_id), sizeof(id));
+        memcpy(&len, rec->detail + offsetof(BalanceHistory, s_history_len), sizeof(len));
+        printf("BALANCE_HISTORY: [id=%d, len=%d]\n", id, len);
+    } break;
+    case CS_REQUEST:
+        printf("CS_REQUEST\n");
+        break;
+    case CS_REPLY:
+        printf("CS_REPLY\n");
+        break;
+    case CS_RELEASE:
+        printf("CS_RELEASE\n");
+        break;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    FILE * in = (argc > 1) ? fopen(argv[1], "rb") : stdin;
+    if (in == NULL) {
+        perror("binlog_decode open error");
+        return EXIT_FAILURE;
+    }
+
+    BinlogRecord rec;
+    char text[256 * BINLOG_SLOT + 1];
+    size_t count = 0;
+    while (fread(&rec, sizeof(rec), 1, in) == 1) {
+        if (rec.magic != BINLOG_MAGIC) {
+            fprintf(stderr, "binlog_decode: bad record %zu\n", count);
+            return EXIT_FAILURE;
+        }
+        if (rec.extra > 0 && fread(text, BINLOG_SLOT, rec.extra, in) != rec.extra) {
+            fprintf(stderr, "binlog_decode: truncated record %zu\n", count);
+            return EXIT_FAILURE;
+        }
+        text[rec.extra * BINLOG_SLOT] = '\0';
+        print_record(&rec, text);
+        count++;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evlog.h"
+#include "proc.h"
+
+/* Merge event segments of --evlog into events.log
+ *
+ *    evlog_merge [-o events.log] events.*.seg
+ *
+ * Records of a segment are already ordered by time, so segments are
+ * merged k-way with a binary heap of their heads, ordered by
+ * (time, process id, seq). Ties of Lamport time go to the lower id,
+ * which is the usual total order over Lamport timestamps.
+ */
+
+typedef struct {
+    const char * base;
+    size_t pos;
+    size_t used;
+    const EvlogRecord * head;
+} Segment;
+
+static int before(const EvlogRecord * a, const EvlogRecord * b)
+{
+    if (a->time != b->time) {
+        return a->time < b->time;
+    }
+    if (a->self != b->self) {
+        return a->self < b->self;
+    }
+    return a->seq < b->seq;
+}
+
+/**
+ * @return 1 if the segment has a record at pos, 0 if it's used up
+ */
+static int segment_next(Segment * seg)
+{
+    if (seg->pos + sizeof(EvlogRecord) > seg->used) {
+        return 0;
+    }
+    seg->head = (const EvlogRecord *)(seg->base + seg->pos);
+    seg->pos += (sizeof(EvlogRecord) + seg->head->len + EVLOG_ALIGN - 1) & ~(size_t)(EVLOG_ALIGN - 1);
+    return 1;
+}
+
+static void sift_down(Segment ** heap, int len, int i)
+{
+    while (1) {
+        int min = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < len && before(heap[left]->head, heap[min]->head)) {
+            min = left;
+        }
+        if (right < len && before(heap[right]->head, heap[min]->head)) {
+            min = right;
+        }
+        if (min == i) {
+            return;
+        }
+        Segment * tmp = heap[i];
+        heap[i] = heap[min];
+        heap[min] = tmp;
+        i = min;
+    }
+}
+
+static int segment_open(const char * path, Segment * seg)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || RC_FAIL(fstat(fd, &st)) || (size_t)st.st_size < sizeof(EvlogHeader)) {
+        fprintf(stderr, "evlog_merge: can't read %s\n", path);
+        return -1;
+    }
+    seg->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (seg->base == MAP_FAILED) {
+        perror("evlog_merge mmap error");
+        return -1;
+    }
+
+    const EvlogHeader * header = (const EvlogHeader *)seg->base;
+    if (header->magic != EVLOG_MAGIC || header->used > (uint64_t)st.st_size) {
+        fprintf(stderr, "evlog_merge: %s is not an event segment\n", path);
+        return -1;
+    }
+    seg->pos = sizeof(EvlogHeader);
+    seg->used = header->used;
+    return 0;
+}
+
+int main(int argc, char * argv[])
+{
+    FILE * out = stdout;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                perror("evlog_merge open error");
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr, "%s [-o events.log] events.*.seg\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int count = argc - optind;
+    Segment * segments = calloc(count, sizeof(Segment));
+    Segment ** heap = calloc(count, sizeof(Segment *));
+    int len = 0;
+    for (int i = 0; i < count; i++) {
+        if (RC_FAIL(segment_open(argv[optind + i], &segments[i]))) {
+            return EXIT_FAILURE;
+        }
+        if (segment_next(&segments[i])) {
+            heap[len++] = &segments[i];
+        }
+    }
+    for (int i = len / 2 - 1; i >= 0; i--) {
+        sift_down(heap, len, i);
+    }
+
+    while (len > 0) {
+        Segment * seg = heap[0];
+        fwrite(seg->head + 1, 1, seg->head->len, out);
+        if (!segment_next(seg)) {
+            heap[0] = heap[--len];
+        }
+        sift_down(heap, len, 0);
+    }
+
+    return (fclose(out) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+/* Print counters of --stats while the run goes on
+ *
+ *    labstat [-i ms] [-n count] [-c] [-s] [stats.bin]
+ *
+ * First report holds totals so far, every next one rates over the
+ * interval: messages and KB each way, EAGAIN and empty polls, state
+ * of each process, then messages by type. -c adds messages from row
+ * to column, -s time spent in each state, counted from the process
+ * attaching in close_redundant_pipes. labstat stops after count
+ * reports or once every process of the run is gone, so started after
+ * the run it prints the totals of it.
+ */
+
+typedef struct {
+    char * pages; ///< copy of the node pages
+    uint64_t time;
+} Snapshot;
+
+static const char * type_names[] = {
+    "STARTED", "DONE", "ACK", "STOP", "TRANSFER",
+    "BALANCE_HISTORY", "CS_REQUEST", "CS_REPLY", "CS_RELEASE"
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const StatsPage * page_at(const StatsHeader * header, const char * pages, node_id id)
+{
+    return (const StatsPage *)(pages + id * header->page_size);
+}
+
+static int alive(const StatsPage * page)
+{
+    return page->pid > 0 && (kill(page->pid, 0) == 0 || errno != ESRCH);
+}
+
+static void snapshot(const StatsHeader * header, Snapshot * snap)
+{
+    memcpy(snap->pages, (const char *)header + STATS_PAGE, header->nodes * header->page_size);
+    snap->time = now_ns();
+}
+
+static void print_nodes(const StatsHeader * header, const Snapshot * cur, const Snapshot * prev, double scale)
+{
+    if (prev->time == 0) {
+        printf("%5s %8s %-24s %10s %10s %10s %10s %10s %10s %10s\n",
+               "node", "pid", "state", "msg out", "msg in", "KB out", "KB in", "eagain", "empty", "syscalls");
+    }
+    else {
+        printf("%5s %8s %-24s %10s %10s %10s %10s %10s %10s %10s\n",
+               "node", "pid", "state", "msg/s out", "msg/s in", "KB/s out", "KB/s in", "eagain/s", "empty/s", "syscalls/s");
+    }
+    for (node_id id = 0; id < header->nodes; id++) {
+        const StatsPage * now = page_at(header, cur->pages, id);
+        const StatsPage * was = page_at(header, prev->pages, id);
+        StatsCounters sum = {0, 0, 0, 0};
+        StatsCounters old = {0, 0, 0, 0};
+        for (node_id peer = 0; peer < header->nodes; peer++) {
+            sum.sent += now->channels[peer].sent;
+            sum.received += now->channels[peer].received;
+            sum.bytes_sent += now->channels[peer].bytes_sent;
+            sum.bytes_received += now->channels[peer].bytes_received;
+            old.sent += was->channels[peer].sent;
+            old.received += was->channels[peer].received;
+            old.bytes_sent += was->channels[peer].bytes_sent;
+            old.bytes_received += was->channels[peer].bytes_received;
+        }
+
+        const char * state = "-";
+        if (now->state >= 0 && now->state < STATS_STATES && now->state_names[now->state][0] != '\0') {
+            state = now->state_names[now->state];
+        }
+        printf("%5d %8d %-24.24s %10.0f %10.0f %10.1f %10.1f %10.0f %10.0f %10.0f%s\n",
+               id, now->pid, state,
+               (sum.sent - old.sent) * scale, (sum.received - old.received) * scale,
+               (sum.bytes_sent - old.bytes_sent) * scale / 1024, (sum.bytes_received - old.bytes_received) * scale / 1024,
+               (now->eagain - was->eagain) * scale, (now->empty_polls - was->empty_polls) * scale,
+               (now->syscalls - was->syscalls) * scale,
+               alive(now) ? "" : " (gone)");
+    }
+}
+
+static void print_types(const StatsHeader * header, const Snapshot * cur, const Snapshot * prev, double scale)
+{
+    printf("%-16s %10s %10s\n", "type", (prev->time == 0) ? "msg out" : "msg/s out", (prev->time == 0) ? "msg in" : "msg/s in");
+    for (int type = 0; type < STATS_TYPES; type++) {
+        uint64_t sent = 0;
+        uint64_t received = 0;
+        for (node_id id = 0; id < header->nodes; id++) {
+            const StatsPage * now = page_at(header, cur->pages, id);
+            const StatsPage * was = page_at(header, prev->pages, id);
+            sent += now->types[type].sent - was->types[type].sent;
+            received += now->types[type].received - was->types[type].received;
+        }
+        if (sent + received > 0) {
+            printf("%-16s %10.0f %10.0f\n", type_names[type], sent * scale, received * scale);
+        }
+    }
+}
+
+static void print_channels(const StatsHeader * header, const Snapshot * cur, const Snapshot * prev, double scale)
+{
+    printf("%5s", (prev->time == 0) ? "msg" : "msg/s");
+    for (node_id peer = 0; peer < header->nodes; peer++) {
+        printf(" %8d", peer);
+    }
+    printf("\n");
+    for (node_id id = 0; id < header->nodes; id++) {
+        const StatsPage * now = page_at(header, cur->pages, id);
+        const StatsPage * was = page_at(header, prev->pages, id);
+        printf("%5d", id);
+        for (node_id peer = 0; peer < header->nodes; peer++) {
+            printf(" %8.0f", (now->channels[peer].sent - was->channels[peer].sent) * scale);
+        }
+        printf("\n");
+    }
+}
+
+static void print_states(const StatsHeader * header, const Snapshot * cur)
+{
+    for (node_id id = 0; id < header->nodes; id++) {
+        const StatsPage * page = page_at(header, cur->pages, id);
+        printf("%5d", id);
+        for (int state = 0; state < STATS_STATES; state++) {
+            if (page->state_names[state][0] == '\0') {
+                continue;
+            }
+            uint64_t ns = page->state_ns[state];
+            if (state == page->state && alive(page)) {
+                // still in it, the slot gets the time when it's left
+                ns += cur->time - page->state_since;
+            }
+            printf(" %s %.3f ms", page->state_names[state], ns / 1e6);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    int interval_ms = 1000;
+    int count = -1;
+    int channels = 0;
+    int states = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:cs")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'c':
+            channels = 1;
+            break;
+        case 's':
+            states = 1;
+            break;
+        default:
+            fprintf(stderr, "%s [-i ms] [-n count] [-c] [-s] [stats.bin]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    const char * path = (optind < argc) ? argv[optind] : STATS_FILE;
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || RC_FAIL(fstat(fd, &st)) || (size_t)st.st_size < STATS_PAGE) {
+        fprintf(stderr, "labstat: can't read %s\n", path);
+        return EXIT_FAILURE;
+    }
+    const StatsHeader * header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        perror("labstat mmap error");
+        return EXIT_FAILURE;
+    }
+    if (header->magic != STATS_MAGIC || STATS_PAGE + header->nodes * header->page_size > (uint64_t)st.st_size) {
+        fprintf(stderr, "labstat: %s is not a stats file\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // totals first, so the previous snapshot is all zeros
+    size_t size = header->nodes * header->page_size;
+    Snapshot cur = {malloc(size), 0};
+    Snapshot prev = {calloc(1, size), 0};
+    if (cur.pages == NULL || prev.pages == NULL) {
+        perror("labstat malloc error");
+        return EXIT_FAILURE;
+    }
+
+    for (int report = 0; count < 0 || report < count; report++) {
+        if (report > 0) {
+            struct timespec delay = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+            nanosleep(&delay, NULL);
+        }
+        snapshot(header, &cur);
+        double scale = (report == 0) ? 1.0 : 1e9 / (cur.time - prev.time);
+        if (report == 0) {
+            printf("--- totals\n");
+        }
+        else {
+            printf("--- rates over %.2f s\n", (cur.time - prev.time) / 1e9);
+        }
+        print_nodes(header, &cur, &prev, scale);
+        print_types(header, &cur, &prev, scale);
+        if (channels) {
+            print_channels(header, &cur, &prev, scale);
+        }
+        if (states) {
+            print_states(header, &cur);
+        }
+        fflush(stdout);
+
+        // a process that hasn't attached yet is still to come
+        int running = 0;
+        for (node_id id = 0; id < header->nodes; id++) {
+            const StatsPage * page = page_at(header, cur.pages, id);
+            running += page->pid == 0 || alive(page);
+        }
+        if (!running) {
+            break;
+        }
+
+        Snapshot tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "proc.h"
+#include "timeline.h"
+
+/* Turn timelines of --timeline into a Chrome trace
+ *
+ *    timeline_export [-o trace.json] timeline.*.bin
+ *
+ * The output is the JSON trace event format, which chrome://tracing
+ * and ui.perfetto.dev open. A process of the lab is a process of
+ * the trace with three tracks:
+ *  - messages, a short slice per send and receive,
+ *  - fsm, a slice per state lasting until the next state,
+ *  - cs, a slice per critical section.
+ * Slices carry Lamport time in args, ts is CLOCK_MONOTONIC relative
+ * to the first record. Send and receive of a frame are linked with
+ * a flow event, its id is made of channel and seq of the frame.
+ */
+
+enum {
+    TRACK_MESSAGES = 0,
+    TRACK_FSM,
+    TRACK_CS
+};
+
+/// Slice of a message, flows need a slice of nonzero length to bind to
+#define MESSAGE_DUR_US 0.001
+
+typedef struct {
+    TimelineRecord * records;
+    size_t len; ///< records and slots
+} Timeline;
+
+static const char * type_names[] = {
+    "STARTED", "DONE", "ACK", "STOP", "TRANSFER",
+    "BALANCE_HISTORY", "CS_REQUEST", "CS_REPLY", "CS_RELEASE"
+};
+
+static FILE * out;
+static int first_event = 1;
+static uint64_t start_wall = UINT64_MAX;
+
+static const char * type_name(int type)
+{
+    return (type >= 0 && type < (int)(sizeof(type_names) / sizeof(type_names[0]))) ? type_names[type] : "UNKNOWN";
+}
+
+static double ts_us(uint64_t wall)
+{
+    return (wall - start_wall) / 1e3;
+}
+
+static void event_begin(void)
+{
+    fprintf(out, first_event ? "\n" : ",\n");
+    first_event = 0;
+}
+
+static void metadata(int pid, int tid, const char * what, const char * name)
+{
+    event_begin();
+    fprintf(out, "{\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"name\":\"%s\",\"args\":{\"name\":\"%s\"}}", pid, tid, what, name);
+}
+
+static int timeline_load(const char * path, Timeline * tl)
+{
+    FILE * in = fopen(path, "rb");
+    if (in == NULL || fseek(in, 0, SEEK_END) != 0) {
+        fprintf(stderr, "timeline_export: can't read %s\n", path);
+        return -1;
+    }
+    long size = ftell(in);
+    rewind(in);
+    tl->len = size / sizeof(TimelineRecord);
+    tl->records = malloc(size + 1);
+    if (tl->records == NULL || fread(tl->records, sizeof(TimelineRecord), tl->len, in) != tl->len) {
+        fprintf(stderr, "timeline_export: can't read %s\n", path);
+        return -1;
+    }
+    fclose(in);
+
+    for (size_t i = 0; i < tl->len; i += 1 + tl->records[i].extra) {
+        if (tl->records[i].magic != TIMELINE_MAGIC || i + 1 + tl->records[i].extra > tl->len) {
+            fprintf(stderr, "timeline_export: %s is not a timeline, bad record at %zu\n", path, i);
+            return -1;
+        }
+        if (tl->records[i].wall < start_wall) {
+            start_wall = tl->records[i].wall;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return id unique for a frame of channel src to dst, 0 is not used
+ */
+static unsigned long long flow_id(const TimelineRecord * rec, int nodes)
+{
+    int src = (rec->kind == TIMELINE_SEND) ? rec->self : rec->peer;
+    int dst = (rec->kind == TIMELINE_SEND) ? rec->peer : rec->self;
+    return (unsigned long long)rec->seq * nodes * nodes + src * nodes + dst + 1;
+}
+
+static void export_message(const TimelineRecord * rec, int nodes)
+{
+    int send = rec->kind == TIMELINE_SEND;
+    double ts = ts_us(rec->wall);
+
+    event_begin();
+    fprintf(out,
+            "{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s %s %d\",\"cat\":\"%s\","
+            "\"args\":{\"peer\":%d,\"origin\":%d,\"seq\":%u,\"lamport\":%lld}}",
+            rec->self, TRACK_MESSAGES, ts, MESSAGE_DUR_US, type_name(rec->type), send ? "to" : "from", rec->peer,
+            send ? "send" : "receive", rec->peer, rec->origin, rec->seq, (long long)rec->time);
+
+    event_begin();
+    fprintf(out,
+            "{\"ph\":\"%s\",%s\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"id\":%llu,\"name\":\"%s\",\"cat\":\"flow\"}",
+            send ? "s" : "f", send ? "" : "\"bp\":\"e\",", rec->self, TRACK_MESSAGES, ts, flow_id(rec, nodes),
+            type_name(rec->type));
+}
+
+static void export_slice(int pid, int tid, uint64_t begin, uint64_t end, const char * name,
+                         timestamp_ext_t time_begin, timestamp_ext_t time_end)
+{
+    event_begin();
+    fprintf(out,
+            "{\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"%s\","
+            "\"args\":{\"lamport\":%lld,\"lamport_end\":%lld}}",
+            pid, tid, ts_us(begin), (end - begin) / 1e3, name, (long long)time_begin, (long long)time_end);
+}
+
+static void export_timeline(const Timeline * tl, int nodes)
+{
+    if (tl->len == 0) {
+        return;
+    }
+    node_id self = tl->records[0].self;
+    char name[32];
+    snprintf(name, sizeof(name), (self == PARENT_ID) ? "parent" : "node %d", self);
+    metadata(self, 0, "process_name", name);
+    metadata(self, TRACK_MESSAGES, "thread_name", "messages");
+    metadata(self, TRACK_FSM, "thread_name", "fsm");
+    metadata(self, TRACK_CS, "thread_name", "cs");
+
+    const TimelineRecord * state = NULL;
+    const TimelineRecord * cs = NULL;
+    const TimelineRecord * last = NULL;
+    for (size_t i = 0; i < tl->len; i += 1 + tl->records[i].extra) {
+        const TimelineRecord * rec = &tl->records[i];
+        last = rec;
+        switch (rec->kind) {
+        case TIMELINE_SEND:
+        case TIMELINE_RECEIVE:
+            export_message(rec, nodes);
+            break;
+        case TIMELINE_STATE:
+            if (state != NULL) {
+                export_slice(self, TRACK_FSM, state->wall, rec->wall, (const char *)(state + 1), state->time, rec->time);
+            }
+            state = rec;
+            break;
+        case TIMELINE_CS_ENTER:
+            cs = rec;
+            break;
+        case TIMELINE_CS_EXIT:
+            if (cs != NULL) {
+                export_slice(self, TRACK_CS, cs->wall, rec->wall, "critical section", cs->time, rec->time);
+            }
+            cs = NULL;
+            break;
+        }
+    }
+    // last state lasts as long as the process has something to say
+    if (state != NULL) {
+        export_slice(self, TRACK_FSM, state->wall, last->wall, (const char *)(state + 1), state->time, last->time);
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    out = stdout;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            if ((out = fopen(optarg, "w")) == NULL) {
+                perror("timeline_export open error");
+                return EXIT_FAILURE;
+            }
+            break;
+        default:
+            fprintf(stderr, "%s [-o trace.json] timeline.*.bin\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    int count = argc - optind;
+    Timeline * timelines = calloc(count, sizeof(Timeline));
+    int nodes = 0;
+    for (int i = 0; i < count; i++) {
+        if (RC_FAIL(timeline_load(argv[optind + i], &timelines[i]))) {
+            return EXIT_FAILURE;
+        }
+        for (size_t r = 0; r < timelines[i].len; r += 1 + timelines[i].records[r].extra) {
+            const TimelineRecord * rec = &timelines[i].records[r];
+            nodes = (rec->self >= nodes) ? rec->self + 1 : nodes;
+            nodes = (rec->peer >= nodes) ? rec->peer + 1 : nodes;
+        }
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (int i = 0; i < count; i++) {
+        export_timeline(&timelines[i], nodes);
+    }
+    fprintf(out, "\n]}\n");
+
+    return (fclose(out) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
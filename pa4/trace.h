@@ -0,0 +1,49 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "proc.h"
+
+/* Debug tracing into the event log
+ *
+ * TRACE(task, category, level, fmt, ...) writes "file[line]: " and
+ * the formatted text when
+ *  - level is at most TRACE_LEVEL, set at compile time: otherwise the
+ *    condition is a constant and the call is dropped with its
+ *    arguments,
+ *  - and level is TRACE_ERROR or category is on in task->trace,
+ *    the runtime mask given with --trace.
+ *
+ * Queue dumps loop over the queue, guard the loop with TRACE_ON.
+ */
+
+enum {
+    TRACE_ERROR = 1, ///< always on, the process is about to fail
+    TRACE_INFO,      ///< a line per iteration or state change
+    TRACE_DEBUG      ///< a line per message or queue element
+};
+
+enum {
+    TRACE_FSM = 1 << 0,   ///< state machines of parent and children
+    TRACE_CS = 1 << 1,    ///< messages of request_cs and release_cs
+    TRACE_QUEUE = 1 << 2, ///< queue contents after every change
+    TRACE_ALL = TRACE_FSM | TRACE_CS | TRACE_QUEUE
+};
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_INFO
+#endif
+
+#define TRACE_ON(task, category, level) \
+    ((level) <= TRACE_LEVEL && ((level) == TRACE_ERROR || ((task)->trace & (category))))
+
+#define TRACE(task, category, level, ...)                                \
+    do {                                                                 \
+        if (TRACE_ON(task, category, level)) {                           \
+            (void)trace_printf(task, __FILE__, __LINE__, __VA_ARGS__);   \
+        }                                                                \
+    } while (0)
+
+int trace_printf(TaskStruct * task, const char * file, int line, const char * fmt, ...);
+
+int trace_parse(const char * names);
+#endif
@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "tree.h"
+
+/* Binomial tree broadcast
+ *
+ * Ranks are taken relative to the root, rank = (id - root) mod N.
+ * Rank r gets the frame from r with its lowest set bit cleared and
+ * passes it on to r + 2^k for every 2^k below that bit:
+ *
+ *    root 0, N = 8:   0 -> 4, 2, 1
+ *                     4 -> 6, 5      2 -> 3      6 -> 7
+ *
+ * so the last receiver is ceil(log2 N) hops away instead of N - 1
+ * sends at the root. Bigger subtrees are served first.
+ *
+ * Frame keeps the original header with TREE_MAGIC in place of
+ * the magic, and the trailer below after the payload:
+ *
+ *    +---------------+---------+-------------+
+ *    | MessageHeader | payload | TreeTrailer |
+ *    +---------------+---------+-------------+
+ */
+
+typedef struct {
+    uint16_t s_magic; ///< magic of the wrapped frame
+    node_id root;
+} __attribute__((packed)) TreeTrailer;
+
+/**
+ * @param children Array of TREE_MAX_CHILDREN to fill in sending order
+ *
+ * @return number of children of this process in the tree of given root
+ */
+int tree_children(TaskStruct * task, node_id root, node_id * children)
+{
+    int n = task->total_proc;
+    int rank = (task->local_pid - root + n) % n;
+
+    int top = 1;
+    while (top < n) {
+        top <<= 1;
+    }
+    // root owns the whole tree
+    int low = rank ? (rank & -rank) : top;
+
+    int count = 0;
+    for (int step = low >> 1; step > 0; step >>= 1) {
+        if (rank + step < n) {
+            children[count++] = (root + rank + step) % n;
+        }
+    }
+    return count;
+}
+
+/**
+ * @return 0 on success, -1 if the trailer doesn't fit into the payload
+ */
+int tree_wrap(TaskStruct * task, const Message * msg, Message * out)
+{
+    size_t len = msg->s_header.s_payload_len;
+    if (len + sizeof(TreeTrailer) > MAX_PAYLOAD_LEN) {
+        return -1;
+    }
+
+    TreeTrailer trailer = {msg->s_header.s_magic, task->local_pid};
+    out->s_header = msg->s_header;
+    out->s_header.s_magic = TREE_MAGIC;
+    out->s_header.s_payload_len = len + sizeof(trailer);
+    memcpy(out->s_payload, msg->s_payload, len);
+    memcpy(out->s_payload + len, &trailer, sizeof(trailer));
+    return 0;
+}
+
+/**
+ * Strip trailer of a tree frame
+ *
+ * @return root of the broadcast or -1 for plain frames
+ */
+node_id tree_unwrap(Message * msg)
+{
+    if (msg->s_header.s_magic != TREE_MAGIC) {
+        return -1;
+    }
+
+    TreeTrailer trailer;
+    msg->s_header.s_payload_len -= sizeof(trailer);
+    memcpy(&trailer, msg->s_payload + msg->s_header.s_payload_len, sizeof(trailer));
+    msg->s_header.s_magic = trailer.s_magic;
+    return trailer.root;
+}